@@ -1,5 +1,6 @@
 require 'symbiosis/utils'
 require 'symbiosis/host'
+require 'symbiosis/domain_catalog'
 require 'etc'
 
 module Symbiosis
@@ -40,6 +41,20 @@ module Symbiosis
       self.new(name, prefix)
     end
 
+    #
+    # Create a Domain from a hash returned by #to_h, without looking at the
+    # filesystem.
+    #
+    def self.from_h(h)
+      domain = self.allocate
+
+      %w(name prefix directory symlink uid gid user group).each do |attr|
+        domain.instance_variable_set("@#{attr}", h[attr])
+      end
+
+      domain
+    end
+
     #
     # Tests to see if a domain name is valid.  The FQDN is always valid, no
     # matter what it is.
@@ -169,6 +184,23 @@ module Symbiosis
       raise ArgumentError, "#{@directory} owned by a system group (GID less than 1000)" if @gid < 1000
     end
 
+    #
+    # Returns a hash of the domain's name, directories and owner, suitable
+    # for Domain.from_h.
+    #
+    def to_h
+      {
+        "name"      => @name,
+        "prefix"    => @prefix,
+        "directory" => @directory,
+        "symlink"   => @symlink,
+        "uid"       => @uid,
+        "gid"       => @gid,
+        "user"      => @user,
+        "group"     => @group
+      }
+    end
+
     #
     # Global config directory.  Defaults to self.directory/config
     #
@@ -407,46 +439,8 @@ module Symbiosis
       #
       # If our domain is real, see what symlinks are pointing at it.
       #
-      if File.directory?(self.directory)  
-
-        self_stat = File.stat(self.directory)
-
-        #
-        #  For each domain.
-        #
-        Dir.glob( File.join(self.prefix,"*") ) do |entry|
-          #
-          # Skip entry if it isn't a directory
-          #
-          next unless File.directory?(entry)
-
-          #
-          # Check the inodes.
-          #
-          target_stat = File.stat(entry)
-          target_lstat = File.lstat(entry)
-
-          #
-          # Skip unless the target is a link (i.e. stat and lstat inodes differ)
-          # and the stat inode matches our own stat inode.
-          #
-          next unless target_lstat.ino != target_stat.ino and target_stat.ino == self_stat.ino 
-
-          #
-          # Split
-          #
-          this_domain = File.split(entry).last
-
-          #
-          # Don't want dotfiles.
-          #
-          next if this_domain =~ /^\./ 
-      
-          #
-          # And record.
-          #
-          results << this_domain
-        end
+      if File.directory?(self.directory)
+        results += DomainCatalog.for(self.prefix).aliases(self.directory)
       end
 
       #
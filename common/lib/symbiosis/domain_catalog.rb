@@ -0,0 +1,249 @@
+require 'symbiosis/json_store'
+require 'thread'
+
+module Symbiosis
+
+  #
+  # Keeps a list of the domains in a prefix directory, with their owners and
+  # symlink targets, so that finding a domain doesn't mean building a Domain
+  # for every entry in the prefix.
+  #
+  # Each entry is checked with a stat and an lstat before it is used, and is
+  # only worked out again if either has changed.  The prefix is only listed
+  # again if its mtime has changed, and everything is worked out again if
+  # /etc/passwd or /etc/group change, in case a user has been renamed.  For
+  # /srv, the catalog is saved in /var/cache/symbiosis/domains.json, so that
+  # it carries over between runs.
+  #
+  class DomainCatalog
+
+    include JSONStore
+
+    VERSION = 1
+
+    #
+    # Where the catalog for /srv is saved.
+    #
+    CACHE_FILE = "/var/cache/symbiosis/domains.json"
+
+    #
+    # Returns the catalog for a prefix.  There is one per prefix per process.
+    #
+    def self.for(prefix = "/srv")
+      prefix = File.expand_path(prefix)
+
+      @@catalogs_mutex.synchronize do
+        @@catalogs[prefix] ||= new(prefix, ("/srv" == prefix ? CACHE_FILE : nil))
+      end
+    end
+
+    @@catalogs = Hash.new
+    @@catalogs_mutex = Mutex.new
+
+    attr_reader :prefix, :cache_file
+
+    def initialize(prefix = "/srv", cache_file = nil)
+      @prefix       = File.expand_path(prefix)
+      @cache_file   = cache_file
+      @mtimes       = nil
+      @names        = []
+      @listed       = Hash.new
+      @links        = Hash.new
+      @entries      = Hash.new
+      @changed      = false
+      @mutex        = Mutex.new
+
+      load
+    end
+
+    #
+    # Returns an array of all the domains, sorted by name.  Entries that
+    # can't be turned into a Domain are warned about, and skipped.
+    #
+    def all
+      entries = @mutex.synchronize do
+        refresh_names
+        @names.each { |name| update(name) }
+        save
+        @names.collect { |name| @entries[name] }.compact
+      end
+
+      entries.collect { |entry| Domain.from_h(entry) }
+    end
+
+    #
+    # Returns the number of directories in the prefix that look like
+    # domains, whether or not they could be turned into a Domain.
+    #
+    def size
+      @mutex.synchronize do
+        refresh_names
+        @names.count { |name| File.directory?(File.join(@prefix, name)) }
+      end
+    end
+
+    #
+    # Returns the Domain called name, or nil if there isn't one.
+    #
+    def find(name)
+      entry = @mutex.synchronize do
+        refresh_names
+        update(name) if @listed.has_key?(name)
+        save
+        @entries[name]
+      end
+
+      entry.nil? ? nil : Domain.from_h(entry)
+    end
+
+    #
+    # Returns the names of the symlinks in the prefix that point at
+    # directory.
+    #
+    def aliases(directory)
+      inode = File.stat(directory).ino
+
+      @mutex.synchronize do
+        refresh_names
+
+        @names.select { |name| @links[name] == inode }
+      end
+    rescue Errno::ENOENT
+      []
+    end
+
+    private
+
+    #
+    # Lists the prefix again if it has changed.
+    #
+    def refresh_names
+      mtimes = [@prefix, "/etc/passwd", "/etc/group"].collect do |file|
+        begin
+          stat = File.stat(file)
+          [stat.ino, stat.mtime.to_i, stat.mtime.nsec]
+        rescue Errno::ENOENT
+          nil
+        end
+      end
+
+      return if mtimes == @mtimes
+
+      #
+      # Start again if the users or groups have changed.
+      #
+      @entries.clear unless @mtimes.nil? or mtimes[1..-1] == @mtimes[1..-1]
+
+      @names = if mtimes.first.nil?
+        []
+      else
+        Dir.entries(@prefix).select { |name| Domain.is_valid_name?(name) }.sort
+      end
+
+      @listed = Hash[@names.collect { |name| [name, true] }]
+
+      #
+      # Note where each symlink points, so aliases can be found without
+      # looking at every entry each time.
+      #
+      @links = Hash.new
+      @names.each do |name|
+        path = File.join(@prefix, name)
+
+        begin
+          @links[name] = File.stat(path).ino if File.symlink?(path)
+        rescue SystemCallError
+          # dangling symlink
+        end
+      end
+      #
+      # Symlinks are worked out again too, as what they point to within the
+      # prefix may have changed.
+      #
+      @entries.delete_if do |name, entry|
+        !@listed.has_key?(name) or entry["signature"][0] != entry["signature"][1]
+      end
+
+      #
+      # The kernel only updates mtimes every few milliseconds, so if the
+      # prefix has only just changed, it might change again without its mtime
+      # moving.  List it again next time in that case.
+      #
+      mtimes = [nil] + mtimes[1..-1] if mtimes.first and Time.now.to_i - mtimes.first[1] < 2
+
+      @mtimes = mtimes
+      @changed = true
+    end
+
+    #
+    # Works out the entry for name again if it has changed.
+    #
+    def update(name)
+      path = File.join(@prefix, name)
+      sig  = signature(path)
+
+      if sig.nil?
+        @changed = true if @entries.delete(name)
+        return
+      end
+
+      entry = @entries[name]
+      return if entry and entry["signature"] == sig
+
+      begin
+        entry = Domain.new(name, @prefix).to_h
+        entry["signature"] = sig
+        @entries[name] = entry
+      rescue ArgumentError => err
+        #
+        # Don't save failures, in case they're temporary.
+        #
+        warn err.to_s
+        @entries.delete(name)
+      end
+
+      @changed = true
+    end
+
+    #
+    # Returns the inodes of the entry and what it points to, and the owner.
+    # Returns nil unless it is a directory.
+    #
+    def signature(path)
+      lstat = File.lstat(path)
+      stat  = File.stat(path)
+      return nil unless stat.directory?
+
+      [lstat.ino, stat.ino, stat.uid, stat.gid]
+    rescue SystemCallError
+      nil
+    end
+
+    def load
+      data = load_json(@cache_file, "domain catalog")
+
+      return unless data and @prefix == data["prefix"]
+      return unless data["mtimes"].is_a?(Array) and data["entries"].is_a?(Hash)
+
+      #
+      # Always list the prefix again, but keep the entries unless the users
+      # or groups have changed since they were saved.
+      #
+      @mtimes = [nil] + data["mtimes"][1..-1]
+      @entries = data["entries"]
+    end
+
+    #
+    # The cache directory is created when the package is installed.
+    #
+    def save
+      return unless @changed
+      @changed = false
+
+      save_json(@cache_file, "domain catalog",
+        "prefix" => @prefix, "mtimes" => @mtimes, "entries" => @entries)
+    end
+
+  end
+
+end
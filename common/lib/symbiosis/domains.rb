@@ -42,16 +42,10 @@ module Symbiosis
       #
       # Check for domain, and (random.prefix.)?www.domain.
       #
-      possibles = [domain, domain.sub(/^(.*\.)?www\./,"")].collect do |possible|
-        dir = File.join(prefix, possible)
-        next unless File.directory?(dir)
-
-        begin
-          Domain.from_directory(dir)
-        rescue ArgumentError => err
-          warn err.to_s
-        end
+      catalog = DomainCatalog.for(prefix)
 
+      possibles = [domain, domain.sub(/^(.*\.)?www\./,"")].uniq.collect do |possible|
+        catalog.find(possible)
       end.compact
 
       #
@@ -84,33 +78,13 @@ module Symbiosis
     # Find all domains in prefix.  Returns an array of Symbiosis::Domain
     #
     def self.all(prefix = "/srv")
-      results = Array.new
-      possibles = Array.new
+      catalog = DomainCatalog.for(prefix)
 
       #
-      #  For each domain.
+      # The catalog only looks again at entries that have changed since last
+      # time.
       #
-      Dir.glob( File.join(prefix,"*") ) do |entry|
-        #
-        # Only interested in directories
-        #
-        next unless File.directory?(entry)
-
-        this_prefix, domain = File.split(entry)
-
-        #
-        # Sanity check name.
-        #
-        next unless Symbiosis::Domain.is_valid_name?(domain)
-
-        possibles << domain
-
-        begin
-          results << Domain.new(domain, this_prefix)
-        rescue ArgumentError => err
-          warn err.to_s
-        end
-      end
+      results = catalog.all
 
       #
       # Sometimes, significant memory pressure can cause Etc.getpwuid(@uid).name
@@ -118,8 +92,8 @@ module Symbiosis
       # then led to believe there aren't any domains and will delete all sites
       # from sites-enabled.
       #
-      if possibles.length > 0 and results.length == 0
-        raise RuntimeError "No domains detected, but there are entries in /srv. This detection failure could be due to memory pressure."
+      if results.length == 0 and catalog.size > 0
+        raise RuntimeError, "No domains detected, but there are entries in /srv. This detection failure could be due to memory pressure."
       end
 
       results
@@ -0,0 +1,127 @@
+require 'digest/md5'
+require 'symbiosis/json_store'
+
+module Symbiosis
+
+  #
+  # Records a fingerprint of the things that went into generating something,
+  # e.g. a domain's Apache configuration, so that it only needs generating
+  # again when one of them changes.
+  #
+  # Fingerprints are MD5 sums of the stat details of the files involved, and
+  # any other values given.  They are saved as JSON, if a filename is given.
+  #
+  class Fingerprints
+
+    include JSONStore
+
+    VERSION = 1
+
+    #
+    # Fingerprints older than this many seconds are treated as out of date,
+    # so things that depend on the time (e.g. certificate expiry) are checked
+    # now and again.  Defaults to one day.
+    #
+    attr_accessor :max_age
+
+    attr_reader :filename
+
+    #
+    # Returns a fingerprint of a list of files, plus any extra values given.
+    # Each file contributes its inode, size, mtime and ctime, or its
+    # destination if it is a symlink.  Missing files are fine, and count as
+    # nil.
+    #
+    def self.digest(files, *extras)
+      md5 = Digest::MD5.new
+
+      files.each do |file|
+        md5 << file.to_s << "\0"
+
+        begin
+          stat = File.lstat(file)
+          md5 << [stat.ino, stat.size, stat.mtime.to_i, stat.mtime.nsec, stat.ctime.to_i, stat.ctime.nsec].join(" ")
+          md5 << " -> " << File.readlink(file) if stat.symlink?
+        rescue SystemCallError
+          md5 << "nil"
+        end
+
+        md5 << "\0"
+      end
+
+      md5 << extras.inspect
+
+      md5.hexdigest
+    end
+
+    def initialize(filename = nil)
+      @filename = filename
+      @max_age  = 86400
+      @entries  = Hash.new
+      @changed  = false
+
+      load
+    end
+
+    #
+    # Returns true if the fingerprint recorded for key matches digest, and
+    # hasn't expired.
+    #
+    def current?(key, digest, now = Time.now)
+      entry = @entries[key]
+
+      entry.is_a?(Array) and entry[0] == digest and now.to_i - entry[1].to_i < @max_age
+    end
+
+    #
+    # Returns the fingerprint recorded for key, or nil if there isn't one.
+    #
+    def [](key)
+      entry = @entries[key]
+      entry.is_a?(Array) ? entry[0] : nil
+    end
+
+    #
+    # Records the fingerprint for key.
+    #
+    def update(key, digest, now = Time.now)
+      @entries[key] = [digest, now.to_i]
+      @changed = true
+    end
+
+    #
+    # Forgets the fingerprint for key, so it is treated as changed next time.
+    #
+    def delete(key)
+      @changed = true if @entries.delete(key)
+    end
+
+    #
+    # Returns all the keys that have fingerprints.
+    #
+    def keys
+      @entries.keys
+    end
+
+    #
+    # Saves the fingerprints, if anything has changed.  Returns true if the
+    # file was written.
+    #
+    def save
+      return false unless @changed
+      return false unless save_json(@filename, "fingerprints", "entries" => @entries)
+
+      @changed = false
+      true
+    end
+
+    private
+
+    def load
+      data = load_json(@filename, "fingerprints")
+      @entries = data["entries"] if data and data["entries"].is_a?(Hash)
+    end
+
+  end
+
+end
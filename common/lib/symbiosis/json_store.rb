@@ -0,0 +1,61 @@
+require 'json'
+
+module Symbiosis
+
+  #
+  # Loads and saves state kept between runs as a JSON hash, e.g. fingerprints
+  # or the domain catalog.
+  #
+  # Classes that include this define VERSION, which is saved with the data.
+  # Bump it if the saved format changes, and anything saved in the old format
+  # is ignored.
+  #
+  module JSONStore
+
+    private
+
+    #
+    # Returns the hash saved in filename, or nil if there isn't one, or it was
+    # saved with a different VERSION.  Problems are only reported when
+    # running verbosely, as the state can always be worked out again.
+    #
+    def load_json(filename, description)
+      return nil if filename.nil? or !File.exist?(filename)
+
+      data = JSON.parse(File.read(filename))
+      return nil unless data.is_a?(Hash) and self.class::VERSION == data["version"]
+
+      data
+    rescue StandardError => err
+      warn "Ignoring #{description} in #{filename} -- #{err.to_s}" if $VERBOSE
+      nil
+    end
+
+    #
+    # Saves data to filename, along with VERSION.  The file is written to a
+    # temporary file first, and then renamed into place, so readers never
+    # see half of it.  Nothing is saved if the directory isn't writable.
+    # Returns true if the file was written.
+    #
+    def save_json(filename, description, data)
+      return false if filename.nil?
+      return false unless File.writable?(File.dirname(filename))
+
+      tmp = "#{filename}.#{Process.pid}.tmp"
+
+      File.open(tmp, "w", 0644) do |fh|
+        fh.write JSON.dump({"version" => self.class::VERSION}.merge(data))
+      end
+
+      File.rename(tmp, filename)
+
+      true
+    rescue StandardError => err
+      warn "Unable to save #{description} to #{filename} -- #{err.to_s}" if $VERBOSE
+      File.unlink(tmp) if tmp and File.exist?(tmp)
+      false
+    end
+
+  end
+
+end
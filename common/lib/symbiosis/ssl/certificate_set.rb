@@ -1,7 +1,9 @@
 require 'symbiosis/domain'
 require 'symbiosis/ssl'
+require 'symbiosis/ssl/verification_cache'
 require 'symbiosis/utils'
 require 'openssl'
+require 'digest/sha2'
 require 'erb'
 
 module Symbiosis
@@ -13,6 +15,24 @@ module Symbiosis
       include Comparable
       include Symbiosis::Utils
 
+      #
+      # Returns the cache used by #verify.  By default results are only kept
+      # in memory.
+      #
+      def self.cache
+        @@cache
+      end
+
+      #
+      # Sets the cache used by #verify.  Set to nil to turn caching off.
+      #
+      def self.cache=(c)
+        raise ArgumentError, "cache must be a Symbiosis::SSL::VerificationCache" unless c.nil? or c.is_a?(VerificationCache)
+        @@cache = c
+      end
+
+      @@cache = VerificationCache.new
+
       def initialize(domain, directory=nil)
         raise ArgumentError, "domain must be a Symbiosis::Domain" unless domain.is_a?(Symbiosis::Domain)
 
@@ -402,7 +422,111 @@ module Symbiosis
       # If either of these last two checks fail, a
       # OpenSSL::X509::CertificateError is raised.
       #
-      def verify(certificate = self.certificate, key = self.key, store = self.certificate_store, strict_checking=false)
+      # If no arguments are given, the result is cached (see
+      # VerificationCache) and used again until any of the files in the set,
+      # the domain's aliases, or the CA certificates change, or the
+      # certificate starts or expires.
+      #
+      def verify(*args)
+        cache = CertificateSet.cache
+        return do_verify(*args) unless args.empty? and cache.is_a?(VerificationCache)
+
+        key = self.verification_key
+        return do_verify if key.nil?
+
+        now   = Time.now
+        entry = cache.fetch(key, now)
+
+        unless entry.nil?
+          @certificate_file ||= entry["certificate_file"]
+          @key_file         ||= entry["key_file"]
+
+          #
+          # Say again what was wrong last time.
+          #
+          entry["messages"].to_a.each { |msg| puts "\tSSL set #{name}: #{msg}" } if $VERBOSE
+
+          raise OpenSSL::X509::CertificateError, entry["error"] if entry["error"]
+          return entry["result"]
+        end
+
+        entry = { "checked" => now.to_i }
+        error = nil
+        @verify_messages = []
+
+        begin
+          entry["result"] = do_verify
+        rescue OpenSSL::X509::CertificateError => error
+          entry["error"] = error.message
+        end
+
+        entry["certificate_file"] = @certificate_file
+        entry["key_file"]         = @key_file
+        entry["messages"]         = @verify_messages
+
+        #
+        # The result can change when the certificate starts or expires.
+        #
+        expires = now.to_i + cache.max_age
+        if @certificate.is_a?(OpenSSL::X509::Certificate)
+          [@certificate.not_before.to_i, @certificate.not_after.to_i].each do |t|
+            expires = t if t > now.to_i and t < expires
+          end
+        end
+        entry["expires"] = expires
+
+        cache.store(key, entry)
+
+        raise error unless error.nil?
+
+        entry["result"]
+      end
+
+      #
+      # Returns a hash of everything that the result of #verify depends on, or
+      # nil if any of the files couldn't be read.
+      #
+      def verification_key
+        sha = Digest::SHA256.new
+
+        %w(combined key crt cert pem bundle).each do |ext|
+          fn = File.join(self.directory, "ssl.#{ext}")
+          sha << fn << "\0" << (File.exist?(fn) ? File.binread(fn) : "") << "\0"
+        end
+
+        @ca_paths ||= []
+
+        ca_files = [OpenSSL::X509::DEFAULT_CERT_FILE, OpenSSL::X509::DEFAULT_CERT_DIR] + @ca_paths
+        ca_files.each do |fn|
+          stat = (File.exist?(fn) ? File.stat(fn) : nil)
+          sha << fn << "\0" << (stat ? [stat.ino, stat.size, stat.mtime.to_i, stat.mtime.nsec].join(" ") : "") << "\0"
+        end
+
+        #
+        # Files that have been set by hand, rather than found in the
+        # directory, have to be included too.
+        #
+        files = [@certificate_file, @key_file, @certificate_chain_file].compact.reject do |fn|
+          File.dirname(fn) == self.directory and fn =~ /\/ssl\.(combined|key|crt|cert|pem|bundle)$/
+        end
+
+        files.each do |fn|
+          sha << fn << "\0" << File.binread(fn) << "\0"
+        end
+
+        sha << [self.class.name, self.name, @domain.name, @domain.aliases.sort].inspect
+
+        sha.hexdigest
+      rescue SystemCallError
+        nil
+      end
+
+      private
+
+      #
+      # Does the checks for #verify.
+      #
+      def do_verify(certificate = self.certificate, key = self.key, store = self.certificate_store, strict_checking=false)
         unless certificate.is_a?(OpenSSL::X509::Certificate) and key.is_a?(OpenSSL::PKey::PKey)
           return false
         end
@@ -415,7 +539,7 @@ module Symbiosis
           if strict_checking
             raise OpenSSL::X509::CertificateError, msg
           else
-            puts "\tSSL set #{name}: #{msg}" if $VERBOSE
+            report(msg)
           end
         end
 
@@ -463,13 +587,24 @@ module Symbiosis
           if strict_checking
             raise OpenSSL::X509::CertificateError, msg
           else
-            puts "\tSSL set #{name}: #{msg}" if $VERBOSE
+            report(msg)
           end
         end
 
         store.error
       end
 
+      #
+      # Prints a problem found by #do_verify when running verbosely, and notes
+      # it so it can be printed again when the result is taken from the cache.
+      #
+      def report(msg)
+        (@verify_messages ||= []) << msg
+        puts "\tSSL set #{name}: #{msg}" if $VERBOSE
+      end
+
+      public
+
       #
       # This method writes the set out to the directory.  It tries to use the
       # ssl-cert group, present on Debian as the group for the set directory,
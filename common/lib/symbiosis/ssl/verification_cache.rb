@@ -0,0 +1,189 @@
+require 'symbiosis/json_store'
+require 'etc'
+
+module Symbiosis
+
+  class SSL
+
+    #
+    # Caches the results of CertificateSet#verify, keyed on a hash of the
+    # contents of the set's files, the names it has to be valid for, and the
+    # CA certificates it was checked against.  Results are only used until
+    # the certificate starts or expires, or max_age has passed, whichever is
+    # sooner.
+    #
+    # Sets can also be verified ahead of time in several processes at once
+    # using #prefetch, so that a pass over every domain on a host makes use
+    # of all its cores.
+    #
+    class VerificationCache
+
+      include JSONStore
+
+      VERSION = 2
+
+      #
+      # How long, in seconds, a result is used for at most.  Defaults to one
+      # day.
+      #
+      attr_accessor :max_age
+
+      #
+      # How many processes #prefetch uses.  Defaults to the number of CPUs.
+      #
+      attr_accessor :processes
+
+      attr_reader :filename
+
+      #
+      # If a filename is given, results are saved there between runs.
+      #
+      def initialize(filename = nil)
+        @filename  = filename
+        @max_age   = 86400
+        @processes = Etc.nprocessors
+        @entries   = Hash.new
+        @added     = Hash.new
+        @changed   = false
+
+        load
+      end
+
+      #
+      # Returns the result stored under key, or nil if there isn't one, or it
+      # is no longer valid.
+      #
+      def fetch(key, now = Time.now)
+        entry = @entries[key]
+
+        return nil unless entry.is_a?(Hash)
+        return nil unless now.to_i >= entry["checked"].to_i and now.to_i < entry["expires"].to_i
+
+        entry
+      end
+
+      #
+      # Stores a result under key.  The entry must contain "checked" and
+      # "expires" times.
+      #
+      def store(key, entry)
+        @entries[key] = entry
+        @added[key]   = entry
+        @changed      = true
+      end
+
+      #
+      # Returns the number of results stored.
+      #
+      def size
+        @entries.size
+      end
+
+      #
+      # Verifies every certificate set for each of the domains, in up to
+      # #processes worker processes, and stores the results.  Domains are
+      # shared out between the workers, and each sends its results back over
+      # a pipe.  Returns the number of results added.
+      #
+      def prefetch(domains)
+        domains = domains.to_a
+        workers = [@processes.to_i, domains.length].min
+
+        #
+        # Not worth forking for.
+        #
+        return 0 if workers < 2
+
+        before = @entries.size
+
+        children = (0...workers).collect do |n|
+          rd, wr = IO.pipe
+
+          pid = fork do
+            rd.close
+            @added = Hash.new
+
+            #
+            # The parent reports any problems when it looks at each set.
+            #
+            $VERBOSE = $DEBUG = false
+            CertificateSet.cache = self
+
+            domains.each_with_index do |domain, i|
+              next unless i % workers == n
+              verify_domain(domain)
+            end
+
+            wr.write(JSON.dump(@added))
+            wr.close
+            exit!(0)
+          end
+
+          wr.close
+          [pid, rd]
+        end
+
+        children.each do |pid, rd|
+          begin
+            data = rd.read
+            JSON.parse(data).each { |key, entry| store(key, entry) } unless data.empty?
+          rescue JSON::ParserError => err
+            warn "\tIgnoring SSL verification results from process #{pid} -- #{err.to_s}" if $VERBOSE
+          ensure
+            rd.close
+            Process.wait(pid)
+          end
+        end
+
+        @entries.size - before
+      end
+
+      #
+      # Saves the results, if anything has changed, dropping any that have
+      # expired.  Returns true if the file was written.
+      #
+      def save(now = Time.now)
+        return false if @filename.nil? or !@changed
+        return false unless File.writable?(File.dirname(@filename))
+
+        @entries.delete_if { |key, entry| now.to_i >= entry["expires"].to_i }
+
+        return false unless save_json(@filename, "SSL verification results", "entries" => @entries)
+
+        @changed = false
+        true
+      end
+
+      private
+
+      #
+      # Verifies the legacy set, and each set in config/ssl/sets, for a
+      # domain.  Errors are ignored, as they'll be found again, and reported,
+      # by whatever asks for the result.
+      #
+      def verify_domain(domain)
+        dirs = [domain.config_dir]
+
+        dirs += domain.ssl_possible_set_names.collect do |name|
+          File.join(domain.config_dir, "ssl", "sets", name)
+        end
+
+        dirs.each do |dir|
+          begin
+            CertificateSet.new(domain, dir).verify
+          rescue StandardError
+            # do nothing
+          end
+        end
+      end
+
+      def load
+        data = load_json(@filename, "SSL verification results")
+        @entries = data["entries"] if data and data["entries"].is_a?(Hash)
+      end
+
+    end
+
+  end
+
+end
@@ -0,0 +1,140 @@
+module Symbiosis
+
+  #
+  # Runs a job for each of a list of things, e.g. domains, several at once,
+  # each in a process of its own.
+  #
+  #   pool = WorkerPool.new(4, "rotate logs") do |domain, result, seconds|
+  #     ...
+  #   end
+  #
+  #   Symbiosis::Domains.each { |domain| pool.run(domain) { ... } }
+  #   pool.wait
+  #
+  # The result is true or false, depending on what the block returned, or nil
+  # if it raised an error or the process died.  With fewer than two processes
+  # everything is done in this process, one after the other.
+  #
+  class WorkerPool
+
+    #
+    # The output saved up by the current worker, or nil if this isn't one.
+    #
+    @output = nil
+
+    #
+    # Prints a line of output.  Worker processes save it up and print it in
+    # one go when they finish, so it isn't mixed up with that of the others.
+    #
+    def self.puts(s)
+      if @output.nil?
+        $stdout.puts s
+      else
+        @output << s
+      end
+    end
+
+    def self.output=(o)
+      @output = o
+    end
+
+    def self.output
+      @output
+    end
+
+    #
+    # Returns true if this is a worker process.
+    #
+    def self.worker?
+      !@output.nil?
+    end
+
+    attr_reader :processes
+
+    #
+    # Task is a description of the job, used when reporting errors, e.g.
+    # "rotate logs".  The block is called with each thing, the result, and
+    # the number of seconds taken, as each job finishes.
+    #
+    def initialize(processes, task, &on_finish)
+      @processes = (processes.to_i < 1 ? 1 : processes.to_i)
+      @task      = task
+      @on_finish = on_finish
+      @workers   = Hash.new
+    end
+
+    #
+    # Runs the block for item, waiting for another job to finish first if
+    # enough are running already.
+    #
+    def run(item)
+      started = Time.now
+
+      if @processes < 2
+        result = nil
+
+        begin
+          result = (yield ? true : false)
+        rescue StandardError => err
+          warn "** Failed to #{@task} for #{item} -- #{err.to_s}"
+        end
+
+        finished(item, result, Time.now - started)
+        return
+      end
+
+      reap(*Process.wait2) while @workers.length >= @processes
+
+      $stdout.flush
+      $stderr.flush
+
+      pid = fork do
+        self.class.output = []
+        status = 2
+
+        begin
+          status = (yield ? 0 : 1)
+        rescue StandardError => err
+          warn "** Failed to #{@task} for #{item} -- #{err.to_s}"
+        end
+
+        $stdout.print(self.class.output.join("\n") + "\n") unless self.class.output.empty?
+        $stdout.flush
+        $stderr.flush
+        exit!(status)
+      end
+
+      @workers[pid] = [item, started]
+    end
+
+    #
+    # Waits for all the running jobs to finish.
+    #
+    def wait
+      reap(*Process.wait2) until @workers.empty?
+    end
+
+    private
+
+    def reap(pid, status)
+      item, started = @workers.delete(pid)
+      return if item.nil?
+
+      result = case status.exitstatus
+        when 0 then true
+        when 1 then false
+        else
+          warn "** Failed to #{@task} for #{item}"
+          nil
+      end
+
+      finished(item, result, Time.now - started)
+    end
+
+    def finished(item, result, seconds)
+      @on_finish.call(item, result, seconds) unless @on_finish.nil?
+    end
+
+  end
+
+end
@@ -0,0 +1,129 @@
+require 'test/unit'
+require 'tmpdir'
+require 'symbiosis/domains'
+
+class TestDomainCatalog < Test::Unit::TestCase
+
+  include Symbiosis
+
+  def setup
+    @prefix = Dir.mktmpdir("srv")
+    File.lchown(1000,1000,@prefix) if 0 == Process.uid
+    @prefix.freeze
+
+    @cache_file = File.join(@prefix, ".domains.json")
+  end
+
+  def teardown
+    FileUtils.rm_rf(@prefix) if File.directory?(@prefix)
+  end
+
+  def make_domain(name = nil)
+    domain = Domain.new(name, @prefix)
+    domain.create
+    domain
+  end
+
+  def test_all
+    catalog = DomainCatalog.new(@prefix)
+    assert_equal([], catalog.all)
+
+    domains = 3.times.collect { make_domain }
+
+    all = catalog.all
+    assert(all.all?{|d| d.is_a?(Domain)}, "DomainCatalog#all returned something other than a Domain.")
+    assert_equal(domains.collect{|d| d.name}.sort, all.collect{|d| d.name})
+    assert_equal(domains.collect{|d| d.directory}.sort, all.collect{|d| d.directory})
+    assert_equal(domains.first.user, all.first.user)
+
+    #
+    # Removing a domain should be noticed.
+    #
+    FileUtils.rm_rf(domains.first.directory)
+    assert_equal(domains[1..-1].collect{|d| d.name}.sort, catalog.all.collect{|d| d.name})
+  end
+
+  def test_find
+    catalog = DomainCatalog.new(@prefix)
+    assert_nil(catalog.find("example.com"))
+
+    domain = make_domain("example.com")
+    File.symlink(domain.directory, File.join(@prefix, "example.net"))
+
+    found = catalog.find("example.com")
+    assert_equal("example.com", found.name)
+    assert_nil(found.symlink)
+
+    found = catalog.find("example.net")
+    assert_equal("example.net", found.name)
+    assert_equal(domain.directory, found.directory)
+    assert_equal(File.join(@prefix, "example.net"), found.symlink)
+
+    assert_equal(%w(example.net), catalog.aliases(domain.directory))
+
+    #
+    # Point the symlink somewhere else.
+    #
+    other = make_domain("example.org")
+    File.unlink(File.join(@prefix, "example.net"))
+    File.symlink(other.directory, File.join(@prefix, "example.net"))
+
+    assert_equal(other.directory, catalog.find("example.net").directory)
+    assert_equal([], catalog.aliases(domain.directory))
+    assert_equal(%w(example.net), catalog.aliases(other.directory))
+  end
+
+  def test_system_owned
+    return unless 0 == Process.uid
+
+    catalog = DomainCatalog.new(@prefix)
+    domain = make_domain("example.com")
+    File.lchown(0, 0, domain.directory)
+
+    assert_nil(catalog.find("example.com"))
+    assert_equal(1, catalog.size)
+
+    #
+    # Once the owner is sorted out, it should appear.
+    #
+    File.lchown(1000, 1000, domain.directory)
+    assert_equal("example.com", catalog.find("example.com").name)
+  end
+
+  def test_save_and_load
+    domain = make_domain("example.com")
+
+    catalog = DomainCatalog.new(@prefix, @cache_file)
+    assert_equal(%w(example.com), catalog.all.collect{|d| d.name})
+    assert(File.exist?(@cache_file), "DomainCatalog didn't save itself")
+
+    #
+    # A new catalog should use the saved entries, rather than creating
+    # Domains again.
+    #
+    catalog = DomainCatalog.new(@prefix, @cache_file)
+
+    Domain.class_eval do
+      alias_method :orig_initialize, :initialize
+      define_method(:initialize) { |*args| raise "Domain.new called" }
+    end
+
+    begin
+      assert_equal(%w(example.com), catalog.all.collect{|d| d.name})
+      assert_equal(domain.directory, catalog.find("example.com").directory)
+    ensure
+      Domain.class_eval do
+        alias_method :initialize, :orig_initialize
+        remove_method :orig_initialize
+      end
+    end
+
+    #
+    # Rubbish in the file is ignored.
+    #
+    File.open(@cache_file, "w") { |fh| fh.puts "rubbish" }
+    catalog = DomainCatalog.new(@prefix, @cache_file)
+    assert_equal(%w(example.com), catalog.all.collect{|d| d.name})
+  end
+
+end
@@ -0,0 +1,76 @@
+require 'test/unit'
+require 'tmpdir'
+require 'symbiosis/fingerprints'
+
+class TestFingerprints < Test::Unit::TestCase
+
+  include Symbiosis
+
+  def setup
+    @dir = Dir.mktmpdir("fingerprints")
+    @filename = File.join(@dir, "fingerprints.json")
+  end
+
+  def teardown
+    FileUtils.rm_rf(@dir) if File.directory?(@dir)
+  end
+
+  def test_digest
+    file = File.join(@dir, "file")
+    missing = File.join(@dir, "missing")
+
+    digest = Fingerprints.digest([file, missing], "foo")
+    assert_match(/\A[0-9a-f]{32}\z/, digest)
+
+    File.open(file, "w") { |fh| fh.puts "hello" }
+    assert_not_equal(digest, Fingerprints.digest([file, missing], "foo"))
+
+    digest = Fingerprints.digest([file, missing], "foo")
+    assert_equal(digest, Fingerprints.digest([file, missing], "foo"))
+    assert_not_equal(digest, Fingerprints.digest([file, missing], "bar"))
+
+    File.symlink(file, missing)
+    assert_not_equal(digest, Fingerprints.digest([file, missing], "foo"))
+  end
+
+  def test_current
+    now = Time.now
+    fingerprints = Fingerprints.new
+
+    assert(!fingerprints.current?("example.com", "abc", now))
+
+    fingerprints.update("example.com", "abc", now)
+    assert(fingerprints.current?("example.com", "abc", now))
+    assert_equal("abc", fingerprints["example.com"])
+    assert(!fingerprints.current?("example.com", "def", now))
+
+    #
+    # They should expire.
+    #
+    assert(!fingerprints.current?("example.com", "abc", now + fingerprints.max_age))
+
+    fingerprints.delete("example.com")
+    assert(!fingerprints.current?("example.com", "abc", now))
+  end
+
+  def test_save_and_load
+    now = Time.now
+
+    fingerprints = Fingerprints.new(@filename)
+    assert(!fingerprints.save, "Fingerprints saved when nothing had changed")
+
+    fingerprints.update("example.com", "abc", now)
+    assert(fingerprints.save)
+
+    fingerprints = Fingerprints.new(@filename)
+    assert_equal(%w(example.com), fingerprints.keys)
+    assert(fingerprints.current?("example.com", "abc", now))
+
+    #
+    # Rubbish in the file is ignored.
+    #
+    File.open(@filename, "w") { |fh| fh.puts "rubbish" }
+    assert_equal([], Fingerprints.new(@filename).keys)
+  end
+
+end
@@ -0,0 +1,54 @@
+require 'test/unit'
+require 'tmpdir'
+require 'fileutils'
+require 'symbiosis/json_store'
+
+class TestJSONStore < Test::Unit::TestCase
+
+  class Store
+    include Symbiosis::JSONStore
+
+    VERSION = 2
+
+    public :load_json, :save_json
+  end
+
+  def setup
+    @dir = Dir.mktmpdir("json_store")
+    @filename = File.join(@dir, "store.json")
+    @store = Store.new
+  end
+
+  def teardown
+    FileUtils.rm_rf(@dir) if File.directory?(@dir)
+  end
+
+  def test_save_and_load
+    assert_nil(@store.load_json(@filename, "test"))
+
+    assert(@store.save_json(@filename, "test", "entries" => {"a" => 1}))
+    assert_equal({"version" => 2, "entries" => {"a" => 1}}, @store.load_json(@filename, "test"))
+    assert_equal(0644, File.stat(@filename).mode & 0777)
+
+    #
+    # No temporary files should be left behind.
+    #
+    assert_equal(["store.json"], Dir.children(@dir))
+  end
+
+  def test_ignored
+    File.open(@filename, "w") { |fh| fh.write JSON.dump("version" => 1, "entries" => {}) }
+    assert_nil(@store.load_json(@filename, "test"), "Data from another version should be ignored")
+
+    File.open(@filename, "w") { |fh| fh.write "{ broken" }
+    assert_nil(@store.load_json(@filename, "test"), "Broken data should be ignored")
+
+    assert_nil(@store.load_json(nil, "test"))
+  end
+
+  def test_not_saved
+    assert(!@store.save_json(nil, "test", {}))
+    assert(!@store.save_json(File.join(@dir, "missing", "store.json"), "test", {}))
+  end
+
+end
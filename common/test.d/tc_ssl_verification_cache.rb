@@ -0,0 +1,193 @@
+require 'test/unit'
+require 'tmpdir'
+require 'stringio'
+require 'symbiosis/domain/ssl'
+require 'symbiosis/ssl/verification_cache'
+
+class TestSSLVerificationCache < Test::Unit::TestCase
+
+  include Symbiosis
+
+  def setup
+    @prefix = Dir.mktmpdir("srv")
+    File.lchown(1000,1000,@prefix) if 0 == Process.uid
+    @prefix.freeze
+
+    @old_cache = SSL::CertificateSet.cache
+    @cache = SSL::VerificationCache.new
+    SSL::CertificateSet.cache = @cache
+
+    @domain = Domain.new(nil, @prefix)
+    @domain.create
+  end
+
+  def teardown
+    SSL::CertificateSet.cache = @old_cache
+    FileUtils.rm_rf(@prefix) if File.directory?(@prefix)
+  end
+
+  def write_self_signed(domain, lifetime = 86400*30, cn = domain.name)
+    key = OpenSSL::PKey::RSA.new(1024)
+
+    crt = OpenSSL::X509::Certificate.new
+    crt.version    = 2
+    crt.serial     = rand(1 << 32)
+    crt.subject    = OpenSSL::X509::Name.parse("/CN=#{cn}")
+    crt.issuer     = crt.subject
+    crt.public_key = key.public_key
+    crt.not_before = Time.now - 60
+    crt.not_after  = Time.now + lifetime
+    crt.sign(key, OpenSSL::Digest::SHA256.new)
+
+    File.open(File.join(domain.config_dir, "ssl.combined"), "w") { |fh| fh.write(crt.to_pem + key.to_pem) }
+
+    crt
+  end
+
+  #
+  # Counts the number of times the checks are actually done.
+  #
+  def count_verifications
+    count = 0
+
+    SSL::CertificateSet.class_eval do
+      alias_method :orig_do_verify, :do_verify
+      define_method(:do_verify) { |*args| count += 1; orig_do_verify(*args) }
+    end
+
+    yield
+
+    count
+  ensure
+    SSL::CertificateSet.class_eval do
+      alias_method :do_verify, :orig_do_verify
+      remove_method :orig_do_verify
+    end
+  end
+
+  def test_verify_cached
+    write_self_signed(@domain)
+
+    count = count_verifications do
+      assert_equal(18, SSL::CertificateSet.new(@domain, @domain.config_dir).verify)
+
+      set = SSL::CertificateSet.new(@domain, @domain.config_dir)
+      assert_equal(18, set.verify)
+      assert_equal(File.join(@domain.config_dir, "ssl.combined"), set.certificate_file)
+    end
+
+    assert_equal(1, count)
+    assert_equal(1, @cache.size)
+
+    #
+    # A new certificate should be checked again.
+    #
+    write_self_signed(@domain)
+
+    count = count_verifications do
+      assert_equal(18, SSL::CertificateSet.new(@domain, @domain.config_dir).verify)
+    end
+
+    assert_equal(1, count)
+
+    #
+    # As should a new alias.
+    #
+    File.symlink(@domain.directory, File.join(@prefix, "alias-#{@domain.name}"))
+
+    count = count_verifications do
+      SSL::CertificateSet.new(@domain, @domain.config_dir).verify
+    end
+
+    assert_equal(1, count)
+  end
+
+  def test_errors_cached
+    write_self_signed(@domain)
+    File.open(File.join(@domain.config_dir, "ssl.key"), "w") { |fh| fh.write(OpenSSL::PKey::RSA.new(1024).to_pem) }
+    File.unlink(File.join(@domain.config_dir, "ssl.combined"))
+
+    count = count_verifications do
+      2.times do
+        assert_equal(false, SSL::CertificateSet.new(@domain, @domain.config_dir).verify)
+      end
+    end
+
+    assert_equal(1, count)
+  end
+
+  def test_messages_cached
+    write_self_signed(@domain, 86400*30, "other.#{@domain.name}")
+
+    outputs = []
+    verbose, $VERBOSE = $VERBOSE, true
+    stdout = $stdout
+
+    count = count_verifications do
+      2.times do
+        $stdout = StringIO.new
+        SSL::CertificateSet.new(@domain, @domain.config_dir).verify
+        outputs << $stdout.string
+      end
+    end
+
+    assert_equal(1, count)
+    assert_match(/not valid for this domain/, outputs.first)
+    assert_equal(outputs.first, outputs.last, "Cached result didn't say what was wrong")
+  ensure
+    $stdout  = stdout
+    $VERBOSE = verbose
+  end
+
+  def test_expiry
+    now = Time.now
+    write_self_signed(@domain, 120)
+
+    set = SSL::CertificateSet.new(@domain, @domain.config_dir)
+    set.verify
+
+    key = set.verification_key
+    assert_kind_of(Hash, @cache.fetch(key, now))
+    assert_nil(@cache.fetch(key, now + 180), "Cached result used after the certificate expired")
+  end
+
+  def test_save_and_load
+    filename = File.join(@prefix, "ssl-verify.json")
+    cache = SSL::VerificationCache.new(filename)
+    SSL::CertificateSet.cache = cache
+
+    write_self_signed(@domain)
+    SSL::CertificateSet.new(@domain, @domain.config_dir).verify
+    assert(cache.save)
+
+    SSL::CertificateSet.cache = SSL::VerificationCache.new(filename)
+
+    count = count_verifications do
+      assert_equal(18, SSL::CertificateSet.new(@domain, @domain.config_dir).verify)
+    end
+
+    assert_equal(0, count)
+  end
+
+  def test_prefetch
+    domains = [@domain] + 3.times.collect do
+      d = Domain.new(nil, @prefix)
+      d.create
+      d
+    end
+
+    domains.each { |d| write_self_signed(d) }
+
+    @cache.processes = 2
+    assert_equal(4, @cache.prefetch(domains))
+
+    count = count_verifications do
+      domains.each do |d|
+        assert_equal(18, SSL::CertificateSet.new(d, d.config_dir).verify)
+      end
+    end
+
+    assert_equal(0, count)
+  end
+
+end
@@ -0,0 +1,89 @@
+require 'test/unit'
+require 'stringio'
+require 'symbiosis/worker_pool'
+
+class TestWorkerPool < Test::Unit::TestCase
+
+  include Symbiosis
+
+  def run_pool(processes, items)
+    results = Hash.new
+    pool = WorkerPool.new(processes, "test") do |item, result, seconds|
+      assert(seconds >= 0)
+      results[item] = result
+    end
+
+    old_stderr, $stderr = $stderr, StringIO.new
+
+    begin
+      items.each do |item|
+        pool.run(item) do
+          raise "failed" if "error" == item
+          "yes" == item
+        end
+      end
+
+      pool.wait
+    ensure
+      $stderr = old_stderr
+    end
+
+    results
+  end
+
+  def test_run
+    expected = {"yes" => true, "no" => false, "error" => nil}
+
+    assert_equal(expected, run_pool(1, %w(yes no error)))
+    assert_equal(expected, run_pool(2, %w(yes no error)))
+  end
+
+  def test_many_items
+    results = Hash.new { |h,k| h[k] = [] }
+
+    pool = WorkerPool.new(3, "test") do |item, result, seconds|
+      results[result] << item
+    end
+
+    10.times { |i| pool.run(i) { i.even? } }
+    pool.wait
+
+    assert_equal([0, 2, 4, 6, 8], results[true].sort)
+    assert_equal([1, 3, 5, 7, 9], results[false].sort)
+  end
+
+  def test_output
+    assert(!WorkerPool.worker?)
+
+    pool = WorkerPool.new(2, "test")
+    r, w = IO.pipe
+
+    pid = fork do
+      r.close
+      $stdout.reopen(w)
+      pool.run("a") do
+        WorkerPool.puts "one"
+        sleep 0.2
+        WorkerPool.puts "two"
+        WorkerPool.worker?
+      end
+      pool.run("b") do
+        WorkerPool.puts "three"
+        true
+      end
+      pool.wait
+      exit!(0)
+    end
+
+    w.close
+    Process.wait(pid)
+    lines = r.read.split("\n")
+
+    #
+    # Each worker's output should come out in one piece.
+    #
+    assert_equal(3, lines.length)
+    assert_equal(["one", "two"], lines - ["three"])
+  end
+
+end
@@ -13,7 +13,14 @@
  *  2.  Once a valid entry has been found ensure that the owner of
  *      /srv/$name and /srv/$name/config/crontab matches.
  *
- *  3.  Invoke our ruby wrapper as the appropriate user, via /bin/su.
+ *  3.  Parse the time fields of the crontab, and skip it if nothing in it
+ *      is due to run this minute.
+ *
+ *  4.  Invoke our ruby wrapper as the appropriate user, via /bin/su.
+ *
+ * When run with --daemon the parsed crontabs are kept in memory instead,
+ * and we sleep until the next one is due.  /srv is only rescanned when
+ * inotify tells us something has changed beneath it.
  *
  * Steve
  * --
@@ -29,50 +36,634 @@
 #include <grp.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "symbiosis-crontab-schedule.h"
 
 /**
  * Global verbosity flag.
  */
 int g_verbose = 0;
 
+/**
+ * In daemon mode, the inotify descriptor that process_domains adds watches
+ * to for each domain it visits.  -1 otherwise.
+ */
+int g_inotify_fd = -1;
+
+/**
+ * Set in one-shot mode when jobs need accounting for, or their cgroups
+ * tidying up, so each job is started from a process of its own that waits
+ * for it.
+ */
+int g_supervise_jobs = 0;
+
 #define CRONTAB_HELPER "/usr/bin/symbiosis-crontab"
 #define SRV_DIR        "/srv"
+#define DAEMON_LOCK    "/run/symbiosis-all-crontabs.lock"
 
 /**
- * fork() so that we can launch a program in the background.
+ * In daemon mode, the longest we'll sleep before rescanning /srv anyway.
+ */
+#define DAEMON_RESCAN_INTERVAL 3600
+
+/**
+ * The number of buckets in our user and group caches.
+ */
+#define CACHE_BUCKETS 256
+
+/**
+ * A cached passwd entry and supplementary group list for a UID.
+ *
+ * Lots of domains are often owned by the same user, so we look each UID up
+ * once per scan, rather than once per domain.
  */
-void process_crontab( char *crontab_path, char *domain_path, struct passwd *usr )
+struct user_entry
 {
-    pid_t pid;
-    int   ngroups;
-    gid_t *groups;
+    uid_t  uid;
 
     /**
-     * Maximum number of groups
+     * Zero if the lookup failed, so that failures are cached too.
      */
-    ngroups = (unsigned int) sysconf(_SC_NGROUPS_MAX);
+    int    valid;
 
-    if( g_verbose )
-      printf("Processing: %s as UID %i:%i\n", crontab_path, usr->pw_uid, usr->pw_gid );
+    struct passwd pw;
 
-    /**
-     * Allocate memory for the group list.
-     */
-    if (NULL == (groups = malloc(ngroups * sizeof (gid_t))))
+    gid_t *groups;
+    int    ngroups;
+
+    struct user_entry *next;
+};
+
+/**
+ * A cached group name for a GID.
+ */
+struct group_entry
+{
+    gid_t  gid;
+    char  *name;
+
+    struct group_entry *next;
+};
+
+struct user_entry  *g_users[ CACHE_BUCKETS ];
+struct group_entry *g_groups[ CACHE_BUCKETS ];
+
+/**
+ * The function called for each valid crontab found by process_domains.
+ *
+ * srv_fd is an open descriptor for the directory being scanned, and
+ * crontab_rel the crontab's path relative to it.
+ */
+typedef void (*crontab_handler)( int srv_fd, char *crontab_rel,
+                                 char *crontab_path, char *domain_path,
+                                 struct stat *crontab, struct user_entry *usr,
+                                 void *data );
+
+/**
+ * Empty the user and group caches.
+ */
+void flush_caches( void )
+{
+    int i;
+
+    for ( i = 0; i < CACHE_BUCKETS; i++ )
+    {
+        while ( g_users[i] != NULL )
+        {
+            struct user_entry *u = g_users[i];
+
+            g_users[i] = u->next;
+            free( u->pw.pw_name );
+            free( u->pw.pw_dir );
+            free( u->pw.pw_shell );
+            free( u->groups );
+            free( u );
+        }
+
+        while ( g_groups[i] != NULL )
+        {
+            struct group_entry *g = g_groups[i];
+
+            g_groups[i] = g->next;
+            free( g->name );
+            free( g );
+        }
+    }
+}
+
+/**
+ * Look up a UID in /etc/passwd, along with its supplementary groups.
+ *
+ * Returns NULL if there is no such user.
+ */
+struct user_entry *lookup_user( uid_t uid )
+{
+    struct user_entry **bucket = &g_users[ uid % CACHE_BUCKETS ];
+    struct user_entry *u;
+    struct passwd *pw;
+
+    for ( u = *bucket; u != NULL; u = u->next )
+    {
+        if ( u->uid == uid )
+            return ( u->valid ? u : NULL );
+    }
+
+    if ( ( u = calloc( 1, sizeof( struct user_entry ) ) ) == NULL )
     {
-        printf("*** ERROR: Unable to allocate memory for group list\n");
+        printf("*** ERROR: Unable to allocate memory for user cache\n");
         exit(-1);
     }
 
+    u->uid    = uid;
+    u->next   = *bucket;
+    *bucket   = u;
+
+    pw = getpwuid( uid );
+    if ( ( pw == NULL ) ||
+         ( pw->pw_name == NULL ) )
+        return NULL;
+
+    u->pw.pw_uid   = pw->pw_uid;
+    u->pw.pw_gid   = pw->pw_gid;
+    u->pw.pw_name  = strdup( pw->pw_name );
+    u->pw.pw_dir   = strdup( pw->pw_dir ? pw->pw_dir : "" );
+    u->pw.pw_shell = strdup( pw->pw_shell ? pw->pw_shell : "" );
+
     /**
-     *  Retrieve group list 
+     *  Retrieve group list, growing our buffer until it fits.
      */
-    if (getgrouplist(usr->pw_name, usr->pw_gid, groups, &ngroups) == -1) 
+    u->ngroups = 16;
+    for (;;)
+    {
+        int ngroups = u->ngroups;
+        gid_t *groups = realloc( u->groups, ngroups * sizeof( gid_t ) );
+
+        if ( groups == NULL )
+        {
+            printf("*** ERROR: Unable to allocate memory for group list\n");
+            exit(-1);
+        }
+
+        u->groups = groups;
+
+        if ( getgrouplist( u->pw.pw_name, u->pw.pw_gid, u->groups, &ngroups ) != -1 )
+        {
+            u->ngroups = ngroups;
+            break;
+        }
+
+        /**
+         * ngroups now holds the number needed, if the buffer was too small.
+         */
+        if ( ngroups <= u->ngroups )
+        {
+            printf("*** ERROR: Unable to get supplementary group list for %s\n", u->pw.pw_name);
+            return NULL;
+        }
+
+        u->ngroups = ngroups;
+    }
+
+    u->valid = ( u->pw.pw_name != NULL && u->pw.pw_dir != NULL && u->pw.pw_shell != NULL );
+
+    return ( u->valid ? u : NULL );
+}
+
+/**
+ * Look up the name of a GID.
+ *
+ * Returns NULL if there is no such group.
+ */
+const char *lookup_group( gid_t gid )
+{
+    struct group_entry **bucket = &g_groups[ gid % CACHE_BUCKETS ];
+    struct group_entry *g;
+    struct group *grp;
+
+    for ( g = *bucket; g != NULL; g = g->next )
     {
-        printf("*** ERROR: Unable to get supplementary group list for %s\n", usr->pw_name);
+        if ( g->gid == gid )
+            return g->name;
+    }
+
+    if ( ( g = calloc( 1, sizeof( struct group_entry ) ) ) == NULL )
+    {
+        printf("*** ERROR: Unable to allocate memory for group cache\n");
         exit(-1);
     }
 
+    g->gid  = gid;
+    g->next = *bucket;
+    *bucket = g;
+
+    grp = getgrgid( gid );
+    if ( ( grp != NULL ) &&
+         ( grp->gr_name != NULL ) )
+        g->name = strdup( grp->gr_name );
+
+    return g->name;
+}
+
+/**
+ * Optional settings, each read from a file beneath SETTINGS_DIR.
+ *
+ *   cgroup      - a cgroup v2 directory to run jobs beneath, e.g.
+ *                 /sys/fs/cgroup/symbiosis-cron.slice
+ *   cpu.weight  - written to each domain's cgroup.
+ *   memory.max  - written to each domain's cgroup.
+ *   accounting  - a file to append a line to for each job that finishes.
+ */
+#define SETTINGS_DIR "/etc/symbiosis/cron.d"
+
+char g_cgroup[ 512 ]     = { "\0" };
+char g_cpu_weight[ 32 ]  = { "\0" };
+char g_memory_max[ 32 ]  = { "\0" };
+char g_accounting[ 512 ] = { "\0" };
+
+/**
+ * The accounting file, if we have one open.
+ */
+int g_accounting_fd = -1;
+
+/**
+ * Set once the parent cgroup has been created.
+ */
+int g_cgroup_ready = 0;
+
+/**
+ * A job we've started, and are waiting for.
+ */
+struct cron_job
+{
+    pid_t  pid;
+    uid_t  uid;
+    char   domain[ 256 ];
+    char   cgroup[ 1024 ];
+    time_t started;
+    struct timespec start;
+
+    struct cron_job *next;
+};
+
+struct cron_job *g_jobs = NULL;
+
+/**
+ * Read the first line of a settings file into buf.  buf is left empty if
+ * the file is missing.
+ */
+void read_setting( const char *name, char *buf, size_t len )
+{
+    char path[ 1024 ];
+    FILE *fh;
+
+    buf[0] = '\0';
+
+    snprintf( path, sizeof( path ), "%s/%s", SETTINGS_DIR, name );
+
+    if ( ( fh = fopen( path, "r" ) ) == NULL )
+        return;
+
+    if ( fgets( buf, len, fh ) == NULL )
+        buf[0] = '\0';
+
+    buf[ strcspn( buf, "\r\n" ) ] = '\0';
+
+    fclose( fh );
+}
+
+/**
+ * Load our settings, and open the accounting file if there is one.
+ */
+void load_settings( void )
+{
+    if ( g_accounting_fd != -1 )
+    {
+        close( g_accounting_fd );
+        g_accounting_fd = -1;
+    }
+
+    g_cgroup_ready = 0;
+
+    read_setting( "cgroup",     g_cgroup,     sizeof( g_cgroup ) );
+    read_setting( "cpu.weight", g_cpu_weight, sizeof( g_cpu_weight ) );
+    read_setting( "memory.max", g_memory_max, sizeof( g_memory_max ) );
+    read_setting( "accounting", g_accounting, sizeof( g_accounting ) );
+
+    if ( g_accounting[0] != '\0' )
+    {
+        g_accounting_fd = open( g_accounting, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0640 );
+
+        if ( g_accounting_fd == -1 )
+            printf("*** ERROR: Unable to open accounting file %s\n", g_accounting );
+    }
+}
+
+/**
+ * Write a value into a cgroup control file.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int write_cgroup_file( const char *dir, const char *file, const char *value )
+{
+    char path[ 1200 ];
+    int fd;
+    int ret = 0;
+
+    snprintf( path, sizeof( path ), "%s/%s", dir, file );
+
+    if ( ( fd = open( path, O_WRONLY | O_CLOEXEC ) ) == -1 )
+        return -1;
+
+    if ( write( fd, value, strlen( value ) ) == -1 )
+        ret = -1;
+
+    close( fd );
+
+    if ( ret != 0 && g_verbose )
+        printf("\tFailed to write '%s' to %s\n", value, path );
+
+    return ret;
+}
+
+/**
+ * Read a single number from a cgroup file.  If key is not NULL the file is
+ * read as "key value" lines, and the value for key returned.
+ *
+ * Returns -1 if the value could not be found.
+ */
+long long read_cgroup_value( const char *dir, const char *file, const char *key )
+{
+    char path[ 1200 ];
+    char line[ 256 ];
+    long long value = -1;
+    FILE *fh;
+
+    snprintf( path, sizeof( path ), "%s/%s", dir, file );
+
+    if ( ( fh = fopen( path, "re" ) ) == NULL )
+        return -1;
+
+    while ( fgets( line, sizeof( line ), fh ) != NULL )
+    {
+        size_t klen = ( key == NULL ) ? 0 : strlen( key );
+
+        if ( key == NULL )
+        {
+            value = strtoll( line, NULL, 10 );
+            break;
+        }
+
+        if ( strncmp( line, key, klen ) == 0 && line[klen] == ' ' )
+        {
+            value = strtoll( line + klen + 1, NULL, 10 );
+            break;
+        }
+    }
+
+    fclose( fh );
+
+    return value;
+}
+
+/**
+ * Remove the leaf cgroups beneath a domain's cgroup that were left behind by
+ * jobs that finished after we stopped waiting for them.  Leaves are named
+ * after the job's PID, so any whose process is still alive are left alone,
+ * and rmdir() refuses to remove any that still have something running in
+ * them.
+ */
+void remove_stale_job_cgroups( const char *domain_cgroup )
+{
+    char leaf[ 1100 ];
+    struct dirent *de;
+    DIR *dir;
+    char *end;
+    long pid;
+
+    if ( ( dir = opendir( domain_cgroup ) ) == NULL )
+        return;
+
+    while ( ( de = readdir( dir ) ) != NULL )
+    {
+        pid = strtol( de->d_name, &end, 10 );
+
+        if ( de->d_name[0] == '\0' || *end != '\0' || pid <= 0 )
+            continue;
+
+        if ( kill( (pid_t) pid, 0 ) == 0 || errno != ESRCH )
+            continue;
+
+        snprintf( leaf, sizeof( leaf ), "%s/%s", domain_cgroup, de->d_name );
+
+        if ( rmdir( leaf ) == 0 && g_verbose )
+            printf("\tRemoved stale cgroup %s\n", leaf );
+    }
+
+    closedir( dir );
+}
+
+/**
+ * Set up the cgroup for a domain beneath g_cgroup, applying our limits.
+ *
+ * Each job then gets its own leaf beneath this, so that we can account for
+ * it separately, while the limits apply to the domain as a whole.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int setup_domain_cgroup( const char *domain, char *path, size_t len )
+{
+    if ( g_cgroup[0] == '\0' )
+        return -1;
+
+    if ( ! g_cgroup_ready )
+    {
+        if ( mkdir( g_cgroup, 0755 ) != 0 && errno != EEXIST )
+        {
+            if ( g_verbose )
+                printf("\tUnable to create cgroup %s\n", g_cgroup );
+            return -1;
+        }
+
+        write_cgroup_file( g_cgroup, "cgroup.subtree_control", "+cpu +memory" );
+        g_cgroup_ready = 1;
+    }
+
+    snprintf( path, len, "%s/%s", g_cgroup, domain );
+
+    if ( mkdir( path, 0755 ) != 0 && errno != EEXIST )
+    {
+        if ( g_verbose )
+            printf("\tUnable to create cgroup %s\n", path );
+        return -1;
+    }
+
+    write_cgroup_file( path, "cgroup.subtree_control", "+memory" );
+
+    remove_stale_job_cgroups( path );
+
+    if ( g_cpu_weight[0] != '\0' )
+        write_cgroup_file( path, "cpu.weight", g_cpu_weight );
+
+    if ( g_memory_max[0] != '\0' )
+        write_cgroup_file( path, "memory.max", g_memory_max );
+
+    return 0;
+}
+
+/**
+ * Called in the child, before dropping privileges, to move itself into a
+ * leaf cgroup of its own beneath the domain's.
+ */
+void enter_job_cgroup( const char *domain_cgroup )
+{
+    char leaf[ 1100 ];
+
+    snprintf( leaf, sizeof( leaf ), "%s/%d", domain_cgroup, (int) getpid() );
+
+    if ( mkdir( leaf, 0755 ) != 0 ||
+         write_cgroup_file( leaf, "cgroup.procs", "0" ) != 0 )
+        printf("*** ERROR: Unable to move into cgroup %s\n", leaf );
+}
+
+/**
+ * Returns true if we need to keep track of our jobs, to account for them
+ * or tidy up their cgroups when they finish.
+ */
+int waiting_for_jobs( void )
+{
+    return ( g_cgroup[0] != '\0' || g_accounting_fd != -1 );
+}
+
+/**
+ * Remember a job we've just started.
+ */
+void add_job( pid_t pid, uid_t uid, const char *domain_path, const char *domain_cgroup )
+{
+    struct cron_job *job;
+    const char *domain = strrchr( domain_path, '/' );
+
+    if ( ! waiting_for_jobs() )
+        return;
+
+    if ( ( job = calloc( 1, sizeof( struct cron_job ) ) ) == NULL )
+    {
+        printf("*** ERROR: Unable to allocate memory for job list\n");
+        return;
+    }
+
+    job->pid     = pid;
+    job->uid     = uid;
+    job->started = time( NULL );
+    clock_gettime( CLOCK_MONOTONIC, &job->start );
+
+    snprintf( job->domain, sizeof( job->domain ), "%s", domain ? domain + 1 : domain_path );
+
+    if ( domain_cgroup != NULL )
+        snprintf( job->cgroup, sizeof( job->cgroup ), "%s/%d", domain_cgroup, (int) pid );
+
+    job->next = g_jobs;
+    g_jobs    = job;
+}
+
+/**
+ * Account for a job that has finished, and tidy up its cgroup.
+ */
+void finish_job( pid_t pid, int status, struct rusage *usage )
+{
+    struct cron_job **prev = &g_jobs;
+    struct cron_job *job;
+    struct timespec end;
+    long long cpu_usec = -1, memory_peak = -1, oom_kills = -1;
+    char started[ 32 ];
+    struct tm tm;
+
+    for ( job = g_jobs; job != NULL; prev = &job->next, job = job->next )
+    {
+        if ( job->pid == pid )
+            break;
+    }
+
+    if ( job == NULL )
+        return;
+
+    *prev = job->next;
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    if ( job->cgroup[0] != '\0' )
+    {
+        cpu_usec    = read_cgroup_value( job->cgroup, "cpu.stat", "usage_usec" );
+        memory_peak = read_cgroup_value( job->cgroup, "memory.peak", NULL );
+        oom_kills   = read_cgroup_value( job->cgroup, "memory.events", "oom_kill" );
+
+        /**
+         * This will fail if the job left anything running, which is fine.
+         */
+        if ( rmdir( job->cgroup ) != 0 && g_verbose )
+            printf("\tUnable to remove cgroup %s\n", job->cgroup );
+    }
+
+    if ( g_accounting_fd != -1 )
+    {
+        localtime_r( &job->started, &tm );
+        strftime( started, sizeof( started ), "%Y-%m-%dT%H:%M:%S%z", &tm );
+
+        dprintf( g_accounting_fd,
+                 "%s %s uid=%d pid=%d status=%d wall=%.3f utime=%.3f stime=%.3f maxrss=%ld "
+                 "cgroup_cpu_usec=%lld cgroup_memory_peak=%lld cgroup_oom_kills=%lld\n",
+                 started, job->domain, (int) job->uid, (int) job->pid,
+                 WIFEXITED( status ) ? WEXITSTATUS( status ) : 128 + WTERMSIG( status ),
+                 ( end.tv_sec - job->start.tv_sec ) + ( end.tv_nsec - job->start.tv_nsec ) / 1e9,
+                 usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+                 usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+                 usage->ru_maxrss, cpu_usec, memory_peak, oom_kills );
+    }
+
+    free( job );
+}
+
+/**
+ * Reap any children that have finished.  If block is set, wait until they
+ * all have.
+ */
+void reap_jobs( int block )
+{
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    while ( ( pid = wait4( -1, &status, block ? 0 : WNOHANG, &usage ) ) > 0 )
+        finish_job( pid, status, &usage );
+}
+
+
+/**
+ * fork() so that we can launch a program in the background.
+ */
+void spawn_job( char *crontab_path, char *domain_path, struct user_entry *usr )
+{
+    pid_t pid;
+    char  cgroup[ 1024 ] = { "\0" };
+    const char *domain = strrchr( domain_path, '/' );
+
+    if( g_verbose )
+      printf("Processing: %s as UID %i:%i\n", crontab_path, usr->pw.pw_uid, usr->pw.pw_gid );
+
+    /**
+     * Set up the domain's cgroup, if we're using them.
+     */
+    if ( setup_domain_cgroup( domain ? domain + 1 : domain_path, cgroup, sizeof( cgroup ) ) != 0 )
+        cgroup[0] = '\0';
+
     /**
      * Set environment and args 
      */
@@ -81,20 +672,12 @@ void process_crontab( char *crontab_path, char *domain_path, struct passwd *usr
     char env_logname[ 1024 ] = { "\0" };
     char env_path[ 1024 ]    = { "\0" };
 
-    /**
-     * Live in /srv/domain.com by default 
-     */
-    if ( chdir(domain_path) == -1 ) {
-        printf("*** ERROR: Unable to change to directory %s\n", domain_path);
-        exit(-1);
-    }
-
     /**
      * Fix up environment (this was cleared some time ago)
      */
-    snprintf(env_home,    sizeof(env_home),    "HOME=%s", usr->pw_dir);
-    snprintf(env_shell,   sizeof(env_shell),   "SHELL=%s", usr->pw_shell);
-    snprintf(env_logname, sizeof(env_logname), "LOGNAME=%s", usr->pw_name);
+    snprintf(env_home,    sizeof(env_home),    "HOME=%s", usr->pw.pw_dir);
+    snprintf(env_shell,   sizeof(env_shell),   "SHELL=%s", usr->pw.pw_shell);
+    snprintf(env_logname, sizeof(env_logname), "LOGNAME=%s", usr->pw.pw_name);
     snprintf(env_path,    sizeof(env_path),    "PATH=/usr/local/bin:/usr/bin:/bin");
     char  *env[]  = {env_home, env_shell, env_logname, env_path, (char *) 0};
     char  *args[] = { CRONTAB_HELPER, crontab_path, (char *) 0 };
@@ -104,12 +687,26 @@ void process_crontab( char *crontab_path, char *domain_path, struct passwd *usr
      */  
     if ( (pid = fork()) == 0 )
     {
+        /**
+         * Move into our own cgroup while we're still root.
+         */
+        if ( cgroup[0] != '\0' )
+            enter_job_cgroup( cgroup );
+
+        /**
+         * Live in /srv/domain.com by default 
+         */
+        if ( chdir(domain_path) == -1 ) {
+            printf("*** ERROR: Unable to change to directory %s\n", domain_path);
+            _exit( 1 );
+        }
+
         /**
          *  Permanently change Supplementary groups, GID and UID.
          */
-        if( setgroups(ngroups, groups) == 0 &&
-            setregid(usr->pw_gid, usr->pw_gid) == 0 && 
-            setreuid(usr->pw_uid, usr->pw_uid) == 0  )
+        if( setgroups(usr->ngroups, usr->groups) == 0 &&
+            setregid(usr->pw.pw_gid, usr->pw.pw_gid) == 0 && 
+            setreuid(usr->pw.pw_uid, usr->pw.pw_uid) == 0  )
         {
             execve(*args, args, env);
             printf("*** ERROR: exec failed\n");
@@ -123,29 +720,170 @@ void process_crontab( char *crontab_path, char *domain_path, struct passwd *usr
     }
     else if (pid < 0)
     {
-        printf("*** ERROR: Fork failed\n");
-        exit( 1 );
+        printf("*** ERROR: Fork failed\n");
+        exit( 1 );
+    }
+
+    add_job( pid, usr->pw.pw_uid, domain_path, cgroup[0] != '\0' ? cgroup : NULL );
+
+}
+
+/**
+ * Launch symbiosis-crontab for a crontab.
+ *
+ * In one-shot mode we don't want to wait for every job before exiting, so
+ * if jobs need accounting for, a small intermediate process is forked for
+ * each one.  It starts the job, waits for it, records its usage and tidies
+ * up its cgroup, and then exits.
+ */
+void process_crontab( char *crontab_path, char *domain_path, struct user_entry *usr )
+{
+    pid_t pid;
+
+    if ( ! g_supervise_jobs )
+    {
+        spawn_job( crontab_path, domain_path, usr );
+        return;
+    }
+
+    /**
+     * Don't let the child inherit anything we haven't written out yet.
+     */
+    fflush( stdout );
+
+    if ( ( pid = fork() ) == 0 )
+    {
+        spawn_job( crontab_path, domain_path, usr );
+        reap_jobs( 1 );
+
+        fflush( stdout );
+        _exit( 0 );
+    }
+    else if ( pid < 0 )
+    {
+        printf("*** ERROR: Fork failed\n");
+        exit( 1 );
+    }
+}
+
+/**
+ * Open a crontab for reading, relative to dir_fd.
+ *
+ * The file is re-checked once it is open, in case it has been swapped
+ * since we looked at it.  If it is no longer a regular file owned by uid
+ * NULL is returned with errno set to EPERM.
+ */
+FILE *open_crontab( int dir_fd, char *crontab_path, uid_t uid )
+{
+    struct stat crontab;
+    FILE *fh;
+    int fd;
+
+    fd = openat( dir_fd, crontab_path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC );
+    if ( fd == -1 )
+        return NULL;
+
+    if ( fstat( fd, &crontab ) != 0 ||
+         ! S_ISREG( crontab.st_mode ) ||
+         crontab.st_uid != uid )
+    {
+        close( fd );
+        errno = EPERM;
+        return NULL;
+    }
+
+    if ( ( fh = fdopen( fd, "r" ) ) == NULL )
+        close( fd );
+
+    return fh;
+}
+
+/**
+ * Check to see if anything in the crontab is due to run now.
+ *
+ * If it cannot be read we say it is due, and leave symbiosis-crontab to
+ * complain.
+ */
+int crontab_due_now( int dir_fd, char *crontab_path, uid_t uid, const struct tm *now )
+{
+    FILE *fh;
+    int due;
+
+    if ( ( fh = open_crontab( dir_fd, crontab_path, uid ) ) == NULL )
+        return ( errno != EPERM );
+
+    due = crontab_is_due( fh, now );
+    fclose( fh );
+
+    return due;
+}
+
+/**
+ * Launch symbiosis-crontab for a crontab, if something in it is due now.
+ */
+void run_if_due( int srv_fd, char *crontab_rel, char *crontab_path, char *domain_path,
+                 struct stat *crontab, struct user_entry *usr, void *data )
+{
+    const struct tm *now = data;
+
+    /**
+     * Don't bother starting Ruby if nothing is due.
+     */
+    if ( ! crontab_due_now( srv_fd, crontab_rel, crontab->st_uid, now ) )
+    {
+        if ( g_verbose )
+            printf("\tNothing due in %s\n", crontab_path );
+        return;
     }
 
-    free(groups);
+    process_crontab( crontab_path, domain_path, usr );
+}
+
+/**
+ * Watch a domain and its config directory, so that we notice a crontab being
+ * added, changed or removed.  This is done for every domain, not just those
+ * that have a crontab already.  If config/ doesn't exist yet, the watch on
+ * the domain tells us when it is created, and we add it then.
+ */
+void watch_domain( const char *domain_path )
+{
+    char config_path[ 1100 ];
+
+    if ( g_inotify_fd == -1 )
+        return;
+
+    /**
+     * inotify_add_watch is happy to be called again for things we're
+     * already watching.
+     */
+    inotify_add_watch( g_inotify_fd, domain_path,
+                       IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB );
 
+    snprintf( config_path, sizeof( config_path ), "%s/config", domain_path );
+    inotify_add_watch( g_inotify_fd, config_path,
+                       IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                       IN_CLOSE_WRITE | IN_MODIFY );
 }
 
 /**
 * Process each entry beneath a given directory,
-* looking for crontabs and invoking our ruby wrapper upon each valid
+* looking for crontabs and invoking the handler upon each valid
 * one we find.
+*
+* Everything is looked up relative to the directory, and user and group
+* lookups are cached for the duration of the scan.
 */
-void process_domains( const char *dirname )
+void process_domains( const char *dirname, crontab_handler handler, void *data )
 {
    DIR *dp;
    struct dirent *dent;
+   int srv_fd;
        
    /**
     * Data from /etc/password for the user
     */
-  struct passwd *usr;
-  struct group  *grp;
+  struct user_entry *usr;
+  const char *grp;
 
    /**
     * Open the directory.
@@ -157,6 +895,8 @@ void process_domains( const char *dirname )
        return;
    }
 
+   srv_fd = dirfd(dp);
+
    /**
     * Read each entry in the directory.
     */
@@ -170,6 +910,7 @@ void process_domains( const char *dirname )
         */
        char domain_path[ 1024 ]  = { "\0" };
        char crontab_path[ 1024 ] = { "\0" };
+       char crontab_rel[ 1024 ]  = { "\0" };
 
        /**
         * Get the name of this entry beneath /srv
@@ -190,13 +931,25 @@ void process_domains( const char *dirname )
            continue ;
        }
 
+       /**
+        * If the filesystem tells us the type, we can skip anything that
+        * isn't a directory without a stat.
+        */
+       if ( dent->d_type != DT_DIR && dent->d_type != DT_UNKNOWN )
+       {
+           if ( g_verbose )
+               printf("\tIgnoring as %s/%s is not a directory\n", dirname, entry);
+
+           continue;
+       }
+
        /**
         * Stat /srv/domain to make sure it is a directory
         *
         */
        snprintf(domain_path, sizeof(domain_path)-1,
                 "%s/%s", dirname, entry );
-       if ( lstat(domain_path, &domain ) != 0 )
+       if ( fstatat(srv_fd, entry, &domain, AT_SYMLINK_NOFOLLOW ) != 0 )
        {
            if ( g_verbose )
                printf("\tstat( %s ) - failed\n", domain_path );
@@ -214,7 +967,9 @@ void process_domains( const char *dirname )
 
            continue;
        }
-       
+
+       watch_domain( domain_path );
+
         /**
         * Look for /srv/$name/config/crontab, and make sure it is a file.
         *
@@ -222,8 +977,10 @@ void process_domains( const char *dirname )
        snprintf(crontab_path, sizeof(crontab_path)-1,
                 "%s/%s/config/crontab",
                 dirname, entry );
+       snprintf(crontab_rel, sizeof(crontab_rel)-1,
+                "%s/config/crontab", entry );
 
-       if ( stat( crontab_path, &crontab ) != 0 )
+       if ( fstatat( srv_fd, crontab_rel, &crontab, 0 ) != 0 )
        {
            if ( g_verbose )
                printf("\tIgnoring as %s doesnt exist\n", crontab_path );
@@ -253,21 +1010,29 @@ void process_domains( const char *dirname )
        }
 
 
+      /**
+       * Don't bother asking NSS about system users.
+       */
+      if ( domain.st_uid < 1000 )
+      {
+          if ( g_verbose )
+              printf("Owner UID is less than 1000 for %s -- not processing.\n", domain_path );
+          continue;
+      }
+
       /**
        * Lookup the userid in /etc/password
        */
-      usr = getpwuid(domain.st_uid);
-      if ( ( usr == NULL ) ||
-           ( usr->pw_name == NULL ) )
+      usr = lookup_user(domain.st_uid);
+      if ( usr == NULL )
       {
           if ( g_verbose )
               printf("\tFailed to find username for UID %d\n", domain.st_uid );
           continue;
       }
       
-      grp = getgrgid(domain.st_gid);
-      if ( ( grp == NULL ) ||
-           ( grp->gr_name == NULL ) )
+      grp = lookup_group(domain.st_gid);
+      if ( grp == NULL )
       {
           if ( g_verbose )
               printf("\tFailed to find group for GID %d\n", domain.st_gid );
@@ -277,10 +1042,10 @@ void process_domains( const char *dirname )
       /**
        * make sure that the user has a sane UID
        */
-      if ( usr->pw_uid < 1000 || usr->pw_gid < 1000)
+      if ( usr->pw.pw_uid < 1000 || usr->pw.pw_gid < 1000)
       {
           if ( g_verbose )
-              printf("Owner UID/GID is less than 1000 for %s owned by %s:%s -- not processing.\n", domain_path, usr->pw_name, grp->gr_name );
+              printf("Owner UID/GID is less than 1000 for %s owned by %s:%s -- not processing.\n", domain_path, usr->pw.pw_name, grp );
            continue;
       }
 
@@ -288,7 +1053,7 @@ void process_domains( const char *dirname )
       /*
        * finally process the crontab
        */
-      process_crontab( crontab_path, domain_path, usr );
+      handler( srv_fd, crontab_rel, crontab_path, domain_path, &crontab, usr, data );
     }
 
     closedir(dp);
@@ -296,15 +1061,481 @@ void process_domains( const char *dirname )
 
 
 
+/**
+ * In daemon mode we keep one of these for each crontab.
+ */
+struct domain_schedule
+{
+    char   crontab_path[ 1024 ];
+    char   domain_path[ 1024 ];
+    uid_t  uid;
+
+    /**
+     * Used to tell if the crontab has changed since we last parsed it.
+     */
+    dev_t  dev;
+    ino_t  ino;
+    off_t  size;
+    struct timespec mtime;
+
+    /**
+     * The parsed records.  If any record could not be parsed the crontab
+     * is "broken", and is passed to symbiosis-crontab every minute so that
+     * it can report the error.
+     */
+    struct crontab_schedule *scheds;
+    int    count;
+    int    broken;
+
+    /**
+     * When the crontab is next due, or -1 for never, and when we last
+     * ran it.
+     */
+    time_t next_due;
+    time_t last_run;
+};
+
+/**
+ * All the crontabs we know about, sorted by crontab_path.
+ */
+struct domain_schedules
+{
+    struct domain_schedule *entries;
+    int count;
+    int alloc;
+};
+
+/**
+ * A min-heap of crontabs, keyed on their next due time.
+ */
+struct schedule_heap
+{
+    struct domain_schedule **items;
+    int count;
+};
+
+/**
+ * Set by our SIGHUP handler to force a rescan.
+ */
+volatile sig_atomic_t g_rescan = 0;
+
+void handle_sighup( int sig )
+{
+    g_rescan = 1;
+}
+
+/**
+ * Our SIGCHLD handler does nothing, other than wake us up to reap.
+ */
+void handle_sigchld( int sig )
+{
+}
+
+int compare_domain_schedules( const void *a, const void *b )
+{
+    return strcmp( ((const struct domain_schedule *) a)->crontab_path,
+                   ((const struct domain_schedule *) b)->crontab_path );
+}
+
+/**
+ * Work out when a crontab is next due, at or after "from".
+ */
+time_t domain_schedule_next_due( struct domain_schedule *ds, time_t from )
+{
+    time_t next;
+
+    /**
+     * Round up to the start of the next minute.
+     */
+    from = from + ( 59 - ( from + 59 ) % 60 );
+
+    /**
+     * Never run anything twice in the same minute.
+     */
+    if ( ds->last_run != 0 && from <= ds->last_run )
+        from = ds->last_run + 60;
+
+    if ( ds->broken )
+        return from;
+
+    next = crontab_next_due( ds->scheds, ds->count, from );
+
+    if ( g_verbose && next == -1 )
+        printf("\tNothing in %s is due in the next 30 years\n", ds->crontab_path );
+
+    return next;
+}
+
+/**
+ * (Re-)parse a crontab into a domain_schedule.
+ */
+void load_domain_schedule( struct domain_schedule *ds )
+{
+    FILE *fh;
+
+    free( ds->scheds );
+    ds->scheds = NULL;
+    ds->count  = 0;
+    ds->broken = 0;
+
+    if ( g_verbose )
+        printf("Parsing: %s\n", ds->crontab_path );
+
+    if ( ( fh = open_crontab( AT_FDCWD, ds->crontab_path, ds->uid ) ) == NULL )
+    {
+        ds->broken = ( errno != EPERM );
+        return;
+    }
+
+    if ( crontab_parse( fh, &ds->scheds, &ds->count ) != 0 )
+        ds->broken = 1;
+
+    fclose( fh );
+}
+
+/**
+ * The process_domains handler for daemon mode, which just remembers each
+ * valid crontab.
+ */
+void remember_crontab( int srv_fd, char *crontab_rel, char *crontab_path, char *domain_path,
+                       struct stat *crontab, struct user_entry *usr, void *data )
+{
+    struct domain_schedules *found = data;
+    struct domain_schedule *ds;
+
+    if ( found->count == found->alloc )
+    {
+        struct domain_schedule *tmp;
+        int alloc = ( found->alloc == 0 ) ? 64 : found->alloc * 2;
+
+        tmp = realloc( found->entries, alloc * sizeof( struct domain_schedule ) );
+        if ( tmp == NULL )
+        {
+            printf("*** ERROR: Unable to allocate memory for crontab list\n");
+            exit(-1);
+        }
+
+        found->entries = tmp;
+        found->alloc   = alloc;
+    }
+
+    ds = &found->entries[ found->count++ ];
+    memset( ds, 0, sizeof( *ds ) );
+
+    snprintf( ds->crontab_path, sizeof( ds->crontab_path ), "%s", crontab_path );
+    snprintf( ds->domain_path,  sizeof( ds->domain_path ),  "%s", domain_path );
+    ds->uid   = crontab->st_uid;
+    ds->dev   = crontab->st_dev;
+    ds->ino   = crontab->st_ino;
+    ds->size  = crontab->st_size;
+    ds->mtime = crontab->st_mtim;
+}
+
+void heap_swap( struct schedule_heap *heap, int a, int b )
+{
+    struct domain_schedule *tmp = heap->items[a];
+
+    heap->items[a] = heap->items[b];
+    heap->items[b] = tmp;
+}
+
+void heap_sift_down( struct schedule_heap *heap, int i )
+{
+    for (;;)
+    {
+        int smallest = i;
+        int l = 2 * i + 1;
+        int r = 2 * i + 2;
+
+        if ( l < heap->count && heap->items[l]->next_due < heap->items[smallest]->next_due )
+            smallest = l;
+
+        if ( r < heap->count && heap->items[r]->next_due < heap->items[smallest]->next_due )
+            smallest = r;
+
+        if ( smallest == i )
+            return;
+
+        heap_swap( heap, i, smallest );
+        i = smallest;
+    }
+}
+
+/**
+ * Rebuild the heap from every crontab that is due at some point.
+ */
+void heap_build( struct schedule_heap *heap, struct domain_schedules *all )
+{
+    int i;
+
+    heap->count = 0;
+
+    for ( i = 0; i < all->count; i++ )
+    {
+        if ( all->entries[i].next_due != -1 )
+            heap->items[ heap->count++ ] = &all->entries[i];
+    }
+
+    for ( i = heap->count / 2 - 1; i >= 0; i-- )
+        heap_sift_down( heap, i );
+}
+
+/**
+ * Rescan /srv, re-parsing only those crontabs which have changed since we
+ * last looked, and rebuild the heap.
+ */
+void rescan_domains( const char *dirname, int inotify_fd,
+                     struct domain_schedules *all, struct schedule_heap *heap,
+                     time_t now )
+{
+    struct domain_schedules found = { NULL, 0, 0 };
+    int i;
+
+    if ( g_verbose )
+        printf("Scanning %s\n", dirname );
+
+    /**
+     * Watch /srv for domains coming and going.  inotify_add_watch is happy
+     * to be called again for things we're already watching.
+     */
+    inotify_add_watch( inotify_fd, dirname,
+                       IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB );
+
+    /**
+     * Look users up and read our settings afresh on each scan.
+     */
+    flush_caches();
+    load_settings();
+
+    g_inotify_fd = inotify_fd;
+    process_domains( dirname, remember_crontab, &found );
+    g_inotify_fd = -1;
+
+    qsort( found.entries, found.count, sizeof( struct domain_schedule ),
+           compare_domain_schedules );
+
+    for ( i = 0; i < found.count; i++ )
+    {
+        struct domain_schedule *ds  = &found.entries[i];
+        struct domain_schedule *old = NULL;
+
+        if ( all->count > 0 )
+            old = bsearch( ds, all->entries, all->count, sizeof( struct domain_schedule ),
+                           compare_domain_schedules );
+
+        if ( old != NULL )
+            ds->last_run = old->last_run;
+
+        /**
+         * Keep the parsed records if nothing has changed.
+         */
+        if ( old != NULL &&
+             old->uid == ds->uid && old->dev == ds->dev && old->ino == ds->ino &&
+             old->size == ds->size &&
+             old->mtime.tv_sec == ds->mtime.tv_sec &&
+             old->mtime.tv_nsec == ds->mtime.tv_nsec )
+        {
+            ds->scheds  = old->scheds;
+            ds->count   = old->count;
+            ds->broken  = old->broken;
+            old->scheds = NULL;
+        }
+        else
+        {
+            load_domain_schedule( ds );
+        }
+
+        ds->next_due = domain_schedule_next_due( ds, now );
+    }
+
+    for ( i = 0; i < all->count; i++ )
+        free( all->entries[i].scheds );
+    free( all->entries );
+    free( heap->items );
+
+    *all = found;
+
+    heap->items = malloc( ( all->count + 1 ) * sizeof( struct domain_schedule * ) );
+    if ( heap->items == NULL )
+    {
+        printf("*** ERROR: Unable to allocate memory for crontab heap\n");
+        exit(-1);
+    }
+
+    heap_build( heap, all );
+}
+
+/**
+ * Run as a daemon, sleeping until the next crontab is due.
+ */
+int run_daemon( const char *dirname )
+{
+    struct domain_schedules all = { NULL, 0, 0 };
+    struct schedule_heap heap   = { NULL, 0 };
+    struct sigaction sa;
+    struct pollfd pfd;
+    time_t last_scan = 0;
+    time_t last_now  = 0;
+    int rescan = 1;
+    int lock_fd;
+
+    /**
+     * Make sure only one of us is running.  One-shot runs from cron check
+     * this lock, and stand aside while we hold it.
+     */
+    lock_fd = open( DAEMON_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    if ( lock_fd == -1 || flock( lock_fd, LOCK_EX | LOCK_NB ) != 0 )
+    {
+        printf("*** ERROR: Unable to lock %s -- already running?\n", DAEMON_LOCK );
+        return -1;
+    }
+
+    /**
+     * We're probably logging to the journal, so don't sit on output.
+     */
+    setvbuf( stdout, NULL, _IOLBF, 0 );
+
+    memset( &sa, 0, sizeof( sa ) );
+    sa.sa_handler = handle_sighup;
+    sigaction( SIGHUP, &sa, NULL );
+
+    sa.sa_handler = handle_sigchld;
+    sa.sa_flags   = SA_NOCLDSTOP;
+    sigaction( SIGCHLD, &sa, NULL );
+
+    pfd.fd     = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+    pfd.events = POLLIN;
+
+    if ( pfd.fd == -1 )
+    {
+        printf("*** ERROR: Unable to initialise inotify\n");
+        return -1;
+    }
+
+    for (;;)
+    {
+        time_t now;
+        int timeout;
+
+        /**
+         * Reap any finished jobs.
+         */
+        reap_jobs( 0 );
+
+        now = time( NULL );
+
+        /**
+         * Rescan if something changed, if we've been asked to, if the clock
+         * has gone backwards, or if it has been a while.
+         */
+        if ( g_rescan || now < last_now || now - last_scan >= DAEMON_RESCAN_INTERVAL )
+            rescan = 1;
+
+        if ( rescan )
+        {
+            g_rescan  = 0;
+            rescan    = 0;
+            last_scan = now;
+            rescan_domains( dirname, pfd.fd, &all, &heap, now );
+        }
+
+        last_now = now;
+
+        /**
+         * Run everything that is due.
+         */
+        while ( heap.count > 0 && heap.items[0]->next_due <= now )
+        {
+            struct domain_schedule *ds = heap.items[0];
+            struct user_entry *usr = lookup_user( ds->uid );
+
+            if ( usr == NULL )
+            {
+                if ( g_verbose )
+                    printf("\tFailed to find username for UID %d\n", ds->uid );
+            }
+            else if ( usr->pw.pw_uid < 1000 || usr->pw.pw_gid < 1000 )
+            {
+                if ( g_verbose )
+                    printf("Owner UID/GID is less than 1000 for %s -- not processing.\n", ds->domain_path );
+            }
+            else
+            {
+                process_crontab( ds->crontab_path, ds->domain_path, usr );
+            }
+
+            ds->last_run = ds->next_due;
+            ds->next_due = domain_schedule_next_due( ds, now );
+
+            if ( ds->next_due == -1 )
+                heap_swap( &heap, 0, --heap.count );
+
+            heap_sift_down( &heap, 0 );
+        }
+
+        /**
+         * Sleep until the next job is due, or something changes.
+         */
+        timeout = DAEMON_RESCAN_INTERVAL - ( now - last_scan );
+
+        if ( heap.count > 0 && heap.items[0]->next_due - now < timeout )
+            timeout = heap.items[0]->next_due - now;
+
+        if ( g_verbose && heap.count > 0 )
+            printf("Next due: %s at %s", heap.items[0]->crontab_path,
+                   ctime( &heap.items[0]->next_due ) );
+
+        if ( poll( &pfd, 1, timeout * 1000 ) > 0 )
+        {
+            char buf[ 4096 ] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+            /**
+             * We don't care what changed, just that something did.
+             */
+            while ( read( pfd.fd, buf, sizeof( buf ) ) > 0 )
+                ;
+
+            rescan = 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Returns true if a daemon is holding the lock.
+ */
+int daemon_running( void )
+{
+    int lock_fd;
+    int running = 0;
+
+    lock_fd = open( DAEMON_LOCK, O_RDONLY | O_CLOEXEC );
+    if ( lock_fd == -1 )
+        return 0;
+
+    if ( flock( lock_fd, LOCK_SH | LOCK_NB ) != 0 && errno == EWOULDBLOCK )
+        running = 1;
+
+    close( lock_fd );
+
+    return running;
+}
+
+
+
 /**
  * Entry point to our code.
  *
- * Accept only a single argument "--verbose"
+ * Accept only the arguments "--verbose" and "--daemon"
  */
 int main( int argc, char *argv[] )
 {
     int i;
+    int daemon = 0;
     struct stat statbuf;
+    struct tm now;
+    time_t t;
 
     /**
      * Empty our enviroment
@@ -321,12 +1552,14 @@ int main( int argc, char *argv[] )
     }
 
     /**
-     * Parse arguments looking for a verbose flag.
+     * Parse arguments looking for verbose and daemon flags.
      */
     for ( i = 1; i < argc; i++ )
     {
         if ( strcasecmp( argv[i], "--verbose" ) == 0 )
           g_verbose = 1;
+        if ( strcasecmp( argv[i], "--daemon" ) == 0 )
+          daemon = 1;
     }
 
     /**
@@ -364,11 +1597,48 @@ int main( int argc, char *argv[] )
     }
 
 
+    /**
+     * In daemon mode we never return.
+     */
+    if ( daemon )
+        return run_daemon( SRV_DIR );
+
+    /**
+     * If the daemon is running, it is looking after everything.
+     */
+    if ( daemon_running() )
+    {
+        if ( g_verbose )
+            printf( "symbiosis-all-crontabs --daemon is running.\n" );
+
+        return 0;
+    }
+
+    /**
+     * Work out which minute we're running in, once, so that every domain
+     * is checked against the same time.
+     */
+    t = time( NULL );
+    if ( localtime_r( &t, &now ) == NULL )
+    {
+        if ( g_verbose )
+            printf( "Unable to determine the local time.\n" );
+
+        return -1;
+    }
+
     /**
      * OK we're good to proceed.
      */
-    process_domains( SRV_DIR );
+    load_settings();
+
+    /**
+     * If we're accounting for jobs, or need to tidy up their cgroups, each
+     * job gets a process of its own to wait for it, so we don't have to.
+     */
+    g_supervise_jobs = waiting_for_jobs();
 
+    process_domains( SRV_DIR, run_if_due, &now );
 
     /**
      * All done.
@@ -0,0 +1,677 @@
+/**
+ * This single header-file holds the crontab time-field parsing used by
+ * symbiosis-all-crontabs.
+ *
+ * It understands the same syntax as Symbiosis::CrontabRecord, i.e.
+ *
+ *   - "*", single numbers, ranges "a-b" and out-of-order ranges "b-a".
+ *   - steps "* /n" and "a-b/n" (without the space).
+ *   - comma-separated lists of the above.
+ *   - month and weekday names, e.g. "jan", "mon-fri", "sunday".
+ *   - the @yearly, @annually, @monthly, @weekly, @daily, @midnight and
+ *     @hourly shortcuts.
+ *
+ * The intention is that the wrapper can decide if anything in a crontab is
+ * due this minute *before* forking and starting a Ruby interpreter.  If it
+ * cannot make sense of a crontab it will say that it is due, and leave it
+ * to symbiosis-crontab to report the error as it always has.
+ *
+ */
+
+
+
+#ifndef _SYMBIOSIS_CRONTAB_SCHEDULE_H
+#define _SYMBIOSIS_CRONTAB_SCHEDULE_H 1
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+
+/**
+ * The parsed time-fields of a single crontab record.
+ *
+ * Each field is a bitmask, so bit 5 of "min" is set if the record should
+ * run at five minutes past the hour.
+ */
+struct crontab_schedule
+{
+    uint64_t min;   /* bits 0-59 */
+    uint64_t hour;  /* bits 0-23 */
+    uint64_t mday;  /* bits 1-31 */
+    uint64_t mon;   /* bits 1-12 */
+    uint64_t wday;  /* bits 0-6, Sunday is 0 */
+
+    /**
+     * If both mday and wday are restricted, then match on either.
+     */
+    int lazy_mday_wday_match;
+};
+
+
+/**
+ * Return codes for crontab_parse_line.
+ */
+#define CRONTAB_LINE_RECORD  0
+#define CRONTAB_LINE_IGNORE  1
+#define CRONTAB_LINE_ERROR  -1
+
+
+/**
+ * Return a bitmask with bits first..last set.
+ */
+uint64_t crontab_bits( int first, int last )
+{
+    uint64_t mask = 0;
+    int i;
+
+    for ( i = first; i <= last; i++ )
+        mask |= ( (uint64_t) 1 << i );
+
+    return mask;
+}
+
+
+/**
+ * Is this a character that Ruby's \s would match?
+ */
+int crontab_isspace( char c )
+{
+    return ( c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+             c == '\f' || c == '\v' );
+}
+
+
+/**
+ * Is this a character that Ruby's \w would match?
+ */
+int crontab_isword( char c )
+{
+    return ( isalnum( (unsigned char) c ) || c == '_' );
+}
+
+
+/**
+ * Read a run of digits starting at *p, advancing *p past them.
+ *
+ * Large values are clamped, as anything that big is out of range anyway.
+ */
+int crontab_read_number( const char **p )
+{
+    int n = 0;
+
+    while ( isdigit( (unsigned char) **p ) )
+    {
+        if ( n < 100000 )
+            n = ( n * 10 ) + ( **p - '0' );
+        (*p)++;
+    }
+
+    return n;
+}
+
+
+/**
+ * Replace month or weekday names in a field with their numbers, in the same
+ * way as CrontabRecord.parse does.
+ *
+ * A name must start on a word boundary, and may be followed by any number
+ * of lower-case letters, so "mon", "monday" and "MONDAY" all become "1".
+ *
+ * The names array is NULL terminated, and offset is added to the index of
+ * each name.  The result is written into out, which is outlen bytes long.
+ *
+ * Returns 0 on success, -1 if the result would not fit.
+ */
+int crontab_replace_names( const char *field, const char **names, int offset,
+                           char *out, size_t outlen )
+{
+    char   lower[ 256 ];
+    size_t len = strlen( field );
+    size_t i, o = 0;
+    int    n;
+
+    if ( len >= sizeof( lower ) )
+        return -1;
+
+    for ( i = 0; i <= len; i++ )
+        lower[i] = tolower( (unsigned char) field[i] );
+
+    i = 0;
+    while ( i < len )
+    {
+        int matched = 0;
+
+        if ( i == 0 || ! crontab_isword( lower[i-1] ) )
+        {
+            for ( n = 0; names[n] != NULL; n++ )
+            {
+                size_t nlen = strlen( names[n] );
+
+                if ( strncmp( lower + i, names[n], nlen ) == 0 )
+                {
+                    int written = snprintf( out + o, outlen - o, "%d", n + offset );
+                    if ( written < 0 || (size_t) written >= outlen - o )
+                        return -1;
+
+                    o += written;
+                    i += nlen;
+
+                    while ( lower[i] >= 'a' && lower[i] <= 'z' )
+                        i++;
+
+                    matched = 1;
+                    break;
+                }
+            }
+        }
+
+        if ( matched )
+            continue;
+
+        if ( o + 1 >= outlen )
+            return -1;
+
+        out[o++] = lower[i++];
+    }
+
+    out[o] = '\0';
+    return 0;
+}
+
+
+/**
+ * Parse a single comma-separated time field, setting bits in *mask for each
+ * value between first and last that matches.
+ *
+ * This mirrors CrontabRecord#parse_field, warts and all.  Each entry is
+ * searched for the first "*" or number, optionally followed by "-n" and then
+ * "/n".  Steps are counted from the start of the field's range.
+ *
+ * Returns 0 on success, -1 if the field is badly formatted.
+ */
+int crontab_parse_field( const char *str, int first, int last, uint64_t *mask )
+{
+    const char *entry = str;
+
+    *mask = 0;
+
+    while ( *entry != '\0' )
+    {
+        const char *end = strchr( entry, ',' );
+        const char *p;
+        int star = 0;
+        int f = 0, l = -1, every = 1;
+        int i;
+
+        if ( end == NULL )
+            end = entry + strlen( entry );
+
+        /**
+         * Find the first "*" or digit in this entry.
+         */
+        for ( p = entry; p < end; p++ )
+        {
+            if ( *p == '*' || isdigit( (unsigned char) *p ) )
+                break;
+        }
+
+        if ( p == end )
+        {
+            /**
+             * Ruby's String#split drops trailing empty entries, so "1,"
+             * is OK, but "1,,2" is not.
+             */
+            const char *rest;
+
+            for ( rest = entry; *rest == ','; rest++ )
+                ;
+
+            if ( p == entry && *rest == '\0' )
+                break;
+
+            return -1;
+        }
+
+        if ( *p == '*' )
+        {
+            star = 1;
+            p++;
+        }
+        else
+        {
+            f = crontab_read_number( &p );
+        }
+
+        if ( p < end && *p == '-' && isdigit( (unsigned char) p[1] ) )
+        {
+            p++;
+            l = crontab_read_number( &p );
+        }
+
+        if ( p < end && *p == '/' && isdigit( (unsigned char) p[1] ) )
+        {
+            p++;
+            every = crontab_read_number( &p );
+
+            if ( every < 1 )
+                return -1;
+        }
+
+        if ( star )
+        {
+            f = first;
+            l = last;
+        }
+        else
+        {
+            if ( l < 0 )
+                l = f;
+
+            if ( f < first || f > last || l < first || l > last )
+                return -1;
+        }
+
+        for ( i = first; i <= last; i++ )
+        {
+            /**
+             * Out-of-order ranges wrap around, e.g. "nov-feb".
+             */
+            int in_range = ( l < f ) ? ( i >= f || i <= l ) : ( i >= f && i <= l );
+
+            if ( in_range && ( ( i - first ) % every ) == 0 )
+                *mask |= ( (uint64_t) 1 << i );
+        }
+
+        entry = ( *end == ',' ) ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Parse the five time fields of a record into *sched.
+ *
+ * Returns 0 on success, -1 if any field is badly formatted.
+ */
+int crontab_parse_schedule( char *fields[5], struct crontab_schedule *sched )
+{
+    static const char *wday_names[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat", NULL };
+    static const char *mon_names[]  = { "jan", "feb", "mar", "apr", "may", "jun",
+                                        "jul", "aug", "sep", "oct", "nov", "dec", NULL };
+    char mon[ 512 ];
+    char wday[ 512 ];
+
+    if ( crontab_replace_names( fields[3], mon_names, 1, mon, sizeof( mon ) ) != 0 ||
+         crontab_replace_names( fields[4], wday_names, 0, wday, sizeof( wday ) ) != 0 )
+        return -1;
+
+    if ( crontab_parse_field( fields[0], 0, 59, &sched->min )  != 0 ||
+         crontab_parse_field( fields[1], 0, 23, &sched->hour ) != 0 ||
+         crontab_parse_field( fields[2], 1, 31, &sched->mday ) != 0 ||
+         crontab_parse_field( mon,       1, 12, &sched->mon )  != 0 ||
+         crontab_parse_field( wday,      0, 7,  &sched->wday ) != 0 )
+        return -1;
+
+    /**
+     * Normalise weekdays, so Sunday is always 0.
+     */
+    if ( sched->wday & ( (uint64_t) 1 << 7 ) )
+        sched->wday = ( sched->wday & ~( (uint64_t) 1 << 7 ) ) | 1;
+
+    sched->lazy_mday_wday_match = ( sched->mday != crontab_bits( 1, 31 ) &&
+                                    sched->wday != crontab_bits( 0, 6 ) );
+
+    return 0;
+}
+
+
+/**
+ * Parse a single line from a crontab.
+ *
+ * The line is modified in place.  Comments, blank lines, environment
+ * settings and @reboot lines are ignored, in the same way as
+ * Symbiosis::Crontab#parse.
+ *
+ * Returns CRONTAB_LINE_RECORD and fills in *sched for a record,
+ * CRONTAB_LINE_IGNORE for lines that do not hold a record, and
+ * CRONTAB_LINE_ERROR for lines which symbiosis-crontab would reject.
+ */
+int crontab_parse_line( char *line, struct crontab_schedule *sched )
+{
+    static const struct
+    {
+        const char *name;
+        const char *snippet;
+    } shortcuts[] = {
+        { "@yearly",   "0 0 1 1 *" },
+        { "@annually", "0 0 1 1 *" },
+        { "@monthly",  "0 0 1 * *" },
+        { "@weekly",   "0 0 * * 0" },
+        { "@daily",    "0 0 * * *" },
+        { "@midnight", "0 0 * * *" },
+        { "@hourly",   "0 * * * *" },
+        { NULL, NULL }
+    };
+    char   snippet[ 32 ];
+    char  *fields[5];
+    char  *p;
+    size_t len = strlen( line );
+    int    shortcut = 0;
+    int    i;
+
+    /**
+     * Chomp.
+     */
+    while ( len > 0 && ( line[len-1] == '\n' || line[len-1] == '\r' ) )
+        line[--len] = '\0';
+
+    /**
+     * Skip if line begins with a hash or space, or is empty.
+     */
+    if ( len == 0 || line[0] == '#' || crontab_isspace( line[0] ) )
+        return CRONTAB_LINE_IGNORE;
+
+    /**
+     * Skip unsupported lines.
+     */
+    if ( strncmp( line, "@reboot", 7 ) == 0 )
+        return CRONTAB_LINE_IGNORE;
+
+    /**
+     * Skip environment settings, i.e. /\A[A-Z]+\s*=/
+     */
+    for ( p = line; *p >= 'A' && *p <= 'Z'; p++ )
+        ;
+
+    if ( p > line )
+    {
+        while ( crontab_isspace( *p ) )
+            p++;
+
+        if ( *p == '=' )
+            return CRONTAB_LINE_IGNORE;
+    }
+
+    /**
+     * Expand any shortcut.
+     */
+    p = line;
+
+    for ( i = 0; shortcuts[i].name != NULL; i++ )
+    {
+        size_t nlen = strlen( shortcuts[i].name );
+
+        if ( strncmp( line, shortcuts[i].name, nlen ) == 0 &&
+             crontab_isspace( line[nlen] ) )
+        {
+            strncpy( snippet, shortcuts[i].snippet, sizeof( snippet ) - 1 );
+            snippet[ sizeof( snippet ) - 1 ] = '\0';
+            p = snippet;
+            shortcut = 1;
+            break;
+        }
+    }
+
+    /**
+     * Split off the five time fields.  Each one must be followed by
+     * whitespace, unless it came from a shortcut.
+     */
+    for ( i = 0; i < 5; i++ )
+    {
+        while ( crontab_isspace( *p ) )
+            p++;
+
+        if ( *p == '\0' )
+            return CRONTAB_LINE_ERROR;
+
+        fields[i] = p;
+
+        while ( *p != '\0' && ! crontab_isspace( *p ) )
+            p++;
+
+        if ( *p == '\0' && ! shortcut )
+            return CRONTAB_LINE_ERROR;
+
+        if ( *p != '\0' )
+            *p++ = '\0';
+    }
+
+    if ( crontab_parse_schedule( fields, sched ) != 0 )
+        return CRONTAB_LINE_ERROR;
+
+    return CRONTAB_LINE_RECORD;
+}
+
+
+/**
+ * Returns true if the schedule should be run at the time given, in the same
+ * way as CrontabRecord#ready?
+ */
+int crontab_schedule_ready( const struct crontab_schedule *sched, const struct tm *now )
+{
+    int mday, wday;
+
+    if ( ! ( sched->min  & ( (uint64_t) 1 << now->tm_min ) ) ||
+         ! ( sched->hour & ( (uint64_t) 1 << now->tm_hour ) ) ||
+         ! ( sched->mon  & ( (uint64_t) 1 << ( now->tm_mon + 1 ) ) ) )
+        return 0;
+
+    mday = ( sched->mday & ( (uint64_t) 1 << now->tm_mday ) ) != 0;
+    wday = ( sched->wday & ( (uint64_t) 1 << now->tm_wday ) ) != 0;
+
+    if ( sched->lazy_mday_wday_match )
+        return ( mday || wday );
+
+    return ( mday && wday );
+}
+
+
+/**
+ * Read the crontab from the open stream, and see if any record in it is
+ * due at the time given.
+ *
+ * Returns 1 if something is due, or if any line could not be parsed, and 0
+ * if nothing is due.
+ */
+int crontab_is_due( FILE *fh, const struct tm *now )
+{
+    struct crontab_schedule sched;
+    char   *line = NULL;
+    size_t  size = 0;
+    int     due  = 0;
+
+    while ( ! due && getline( &line, &size, fh ) != -1 )
+    {
+        switch ( crontab_parse_line( line, &sched ) )
+        {
+        case CRONTAB_LINE_RECORD:
+            due = crontab_schedule_ready( &sched, now );
+            break;
+        case CRONTAB_LINE_ERROR:
+            due = 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    free( line );
+
+    return due;
+}
+
+
+
+/**
+ * Read every record from the crontab in the open stream.
+ *
+ * On return *scheds points to an array of *count schedules, which should be
+ * freed by the caller.
+ *
+ * Returns 0 on success, or -1 if any line could not be parsed or the
+ * crontab could not be read.  The records that could be parsed are still
+ * returned.
+ */
+int crontab_parse( FILE *fh, struct crontab_schedule **scheds, int *count )
+{
+    struct crontab_schedule sched;
+    char   *line  = NULL;
+    size_t  size  = 0;
+    int     alloc = 0;
+    int     ret   = 0;
+
+    *scheds = NULL;
+    *count  = 0;
+
+    while ( getline( &line, &size, fh ) != -1 )
+    {
+        int parsed = crontab_parse_line( line, &sched );
+
+        if ( parsed == CRONTAB_LINE_ERROR )
+            ret = -1;
+
+        if ( parsed != CRONTAB_LINE_RECORD )
+            continue;
+
+        if ( *count == alloc )
+        {
+            struct crontab_schedule *tmp;
+
+            alloc = ( alloc == 0 ) ? 8 : alloc * 2;
+            tmp = realloc( *scheds, alloc * sizeof( struct crontab_schedule ) );
+            if ( tmp == NULL )
+            {
+                ret = -1;
+                break;
+            }
+            *scheds = tmp;
+        }
+
+        (*scheds)[ (*count)++ ] = sched;
+    }
+
+    if ( ferror( fh ) )
+        ret = -1;
+
+    free( line );
+
+    return ret;
+}
+
+
+/**
+ * Work out the first minute at or after "from" when the schedule is due,
+ * in the same way as CrontabRecord#next_due.
+ *
+ * Returns the start of that minute, or -1 if the schedule is not due any
+ * time in the 30 years after "from".
+ */
+time_t crontab_schedule_next_due( const struct crontab_schedule *sched, time_t from )
+{
+    struct tm start;
+    struct tm day;
+    int offset;
+
+    if ( localtime_r( &from, &start ) == NULL )
+        return -1;
+
+    for ( offset = 0; ; offset++ )
+    {
+        int first_hour = 0, first_min = 0;
+        int hour, min;
+        int mday, wday;
+
+        /**
+         * Step through the days at noon, which keeps us clear of any
+         * daylight-saving changes.
+         */
+        memset( &day, 0, sizeof( day ) );
+        day.tm_year  = start.tm_year;
+        day.tm_mon   = start.tm_mon;
+        day.tm_mday  = start.tm_mday + offset;
+        day.tm_hour  = 12;
+        day.tm_isdst = -1;
+
+        if ( mktime( &day ) == -1 )
+            return -1;
+
+        if ( day.tm_year - start.tm_year > 30 )
+            return -1;
+
+        if ( ! ( sched->mon & ( (uint64_t) 1 << ( day.tm_mon + 1 ) ) ) )
+            continue;
+
+        mday = ( sched->mday & ( (uint64_t) 1 << day.tm_mday ) ) != 0;
+        wday = ( sched->wday & ( (uint64_t) 1 << day.tm_wday ) ) != 0;
+
+        if ( sched->lazy_mday_wday_match ? ! ( mday || wday ) : ! ( mday && wday ) )
+            continue;
+
+        if ( offset == 0 )
+        {
+            first_hour = start.tm_hour;
+            first_min  = start.tm_min;
+        }
+
+        for ( hour = first_hour; hour < 24; hour++ )
+        {
+            if ( ! ( sched->hour & ( (uint64_t) 1 << hour ) ) )
+                continue;
+
+            for ( min = ( hour == first_hour ) ? first_min : 0; min < 60; min++ )
+            {
+                time_t due;
+
+                if ( ! ( sched->min & ( (uint64_t) 1 << min ) ) )
+                    continue;
+
+                day.tm_hour  = hour;
+                day.tm_min   = min;
+                day.tm_sec   = 0;
+                day.tm_isdst = -1;
+
+                due = mktime( &day );
+
+                /**
+                 * Times that fall in a daylight-saving gap can be pushed
+                 * back by mktime, so make sure we never go backwards.
+                 */
+                if ( due != -1 && due >= from - start.tm_sec )
+                    return due;
+            }
+        }
+    }
+}
+
+
+/**
+ * Work out when the first of an array of schedules is next due, at or
+ * after "from".
+ *
+ * Returns -1 if none of them are due in the next 30 years.
+ */
+time_t crontab_next_due( const struct crontab_schedule *scheds, int count, time_t from )
+{
+    time_t next = -1;
+    int i;
+
+    for ( i = 0; i < count; i++ )
+    {
+        time_t due = crontab_schedule_next_due( &scheds[i], from );
+
+        if ( due != -1 && ( next == -1 || due < next ) )
+            next = due;
+    }
+
+    return next;
+}
+
+
+
+#endif /* _SYMBIOSIS_CRONTAB_SCHEDULE_H */
@@ -0,0 +1,288 @@
+/**
+ * This is a simple driver which runs our crontab schedule parsing
+ * through a number of tests, checking that it agrees with
+ * Symbiosis::CrontabRecord.
+ *
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+
+#include "symbiosis-crontab-schedule.h"
+
+
+
+/**
+ * This structure holds a single test case.
+ */
+struct test_case
+{
+  /**
+   * The crontab line to parse.
+   */
+    char *line;
+
+  /**
+   * The time to check it against, as "YYYY-MM-DD hh:mm".
+   */
+    char *when;
+
+  /**
+   * What we expect crontab_parse_line to return.
+   */
+    int parsed;
+
+  /**
+   * Whether we expect the record to be ready at that time.
+   */
+    int ready;
+};
+
+
+
+/**
+ * Execute a single test case.
+ */
+int
+test_schedule (struct test_case input)
+{
+    struct crontab_schedule sched;
+    struct tm now;
+    char *tmp = strdup (input.line);
+    int parsed, ready = 0;
+
+    memset (&now, 0, sizeof (now));
+    if (strptime (input.when, "%Y-%m-%d %H:%M", &now) == NULL)
+    {
+        printf ("Bad test time: %s\n", input.when);
+        exit (1);
+    }
+
+    /**
+     * Fill in tm_wday.
+     */
+    now.tm_isdst = -1;
+    mktime (&now);
+
+    parsed = crontab_parse_line (tmp, &sched);
+    if (parsed == CRONTAB_LINE_RECORD)
+        ready = crontab_schedule_ready (&sched, &now);
+
+    free (tmp);
+
+    if (parsed == input.parsed && ready == input.ready)
+        return 1;
+
+    /**
+     * OK if we reach here we have a test case failure.
+     */
+    printf ("\n[=--------------  Test fail -----=]\n");
+    printf ("received input : '%s' at %s\n", input.line, input.when);
+    printf ("expected output: parsed %d ready %d\n", input.parsed, input.ready);
+    printf ("actual   output: parsed %d ready %d\n", parsed, ready);
+    printf ("[=--------------  Test fail -----=]\n");
+
+    exit (1);
+}
+
+
+/**
+ * This structure holds a single next-due test case.
+ */
+struct next_due_case
+{
+    char *line;
+    char *from;
+
+  /**
+   * NOTE: NULL means we expect it never to be due.
+   */
+    char *expected;
+};
+
+
+/**
+ * Execute a single next-due test case.
+ */
+int
+test_next_due (struct next_due_case input)
+{
+    struct crontab_schedule sched;
+    struct tm from, due;
+    char *tmp = strdup (input.line);
+    char actual[32] = "never";
+    time_t next;
+
+    memset (&from, 0, sizeof (from));
+    strptime (input.from, "%Y-%m-%d %H:%M", &from);
+    from.tm_isdst = -1;
+
+    if (crontab_parse_line (tmp, &sched) != CRONTAB_LINE_RECORD)
+    {
+        printf ("Bad test line: %s\n", input.line);
+        exit (1);
+    }
+
+    free (tmp);
+
+    next = crontab_schedule_next_due (&sched, mktime (&from));
+    if (next != -1)
+    {
+        localtime_r (&next, &due);
+        strftime (actual, sizeof (actual), "%Y-%m-%d %H:%M", &due);
+    }
+
+    if ((input.expected == NULL && next == -1) ||
+        (input.expected != NULL && strcmp (input.expected, actual) == 0))
+        return 1;
+
+    printf ("\n[=--------------  Test fail -----=]\n");
+    printf ("received input : '%s' from %s\n", input.line, input.from);
+    printf ("expected output: '%s'\n", input.expected ? input.expected : "never");
+    printf ("actual   output: '%s'\n", actual);
+    printf ("[=--------------  Test fail -----=]\n");
+
+    exit (1);
+}
+
+
+/**
+ * Simple driver code.
+ */
+int
+main (int argc, char *argv[])
+{
+
+  /**
+   * This is our array of test cases.
+   *
+   * 2011-10-03 was a Monday, 2011-10-02 a Sunday.
+   */
+    struct test_case tests[] = {
+
+        { "# a comment",                     "2011-10-03 11:11", CRONTAB_LINE_IGNORE, 0 },
+        { "   ",                             "2011-10-03 11:11", CRONTAB_LINE_IGNORE, 0 },
+        { "",                                "2011-10-03 11:11", CRONTAB_LINE_IGNORE, 0 },
+        { "MAILTO=bob@example.com",          "2011-10-03 11:11", CRONTAB_LINE_IGNORE, 0 },
+        { "PATH = /bin:/usr/bin",            "2011-10-03 11:11", CRONTAB_LINE_IGNORE, 0 },
+        { "@reboot echo hi",                 "2011-10-03 11:11", CRONTAB_LINE_IGNORE, 0 },
+
+        { "* * * * * echo hi",               "2011-10-03 11:11", CRONTAB_LINE_RECORD, 1 },
+        { "* * * * * echo hi\n",             "2011-10-03 11:11", CRONTAB_LINE_RECORD, 1 },
+        { "40 18 * * * echo hi",             "2011-10-03 18:40", CRONTAB_LINE_RECORD, 1 },
+        { "40 18 * * * echo hi",             "2011-10-03 18:41", CRONTAB_LINE_RECORD, 0 },
+        { "*/5 * * * * echo hi",             "2011-10-03 18:35", CRONTAB_LINE_RECORD, 1 },
+        { "*/5 * * * * echo hi",             "2011-10-03 18:36", CRONTAB_LINE_RECORD, 0 },
+        { "23 0-23/2 * * * echo hi",         "2011-10-03 04:23", CRONTAB_LINE_RECORD, 1 },
+        { "23 0-23/2 * * * echo hi",         "2011-10-03 05:23", CRONTAB_LINE_RECORD, 0 },
+        { "1,2,50-55 * * * * echo hi",       "2011-10-03 05:52", CRONTAB_LINE_RECORD, 1 },
+        { "1,2,50-55 * * * * echo hi",       "2011-10-03 05:03", CRONTAB_LINE_RECORD, 0 },
+        { "58-2 * * * * echo hi",            "2011-10-03 05:01", CRONTAB_LINE_RECORD, 1 },
+        { "58-2 * * * * echo hi",            "2011-10-03 05:30", CRONTAB_LINE_RECORD, 0 },
+
+        /**
+         * Steps are counted from the start of the field, not the range.
+         */
+        { "1-10/3 * * * * echo hi",          "2011-10-03 05:03", CRONTAB_LINE_RECORD, 1 },
+        { "1-10/3 * * * * echo hi",          "2011-10-03 05:01", CRONTAB_LINE_RECORD, 0 },
+
+        /**
+         * Names.
+         */
+        { "0 9 * * mon-fri echo hi",         "2011-10-03 09:00", CRONTAB_LINE_RECORD, 1 },
+        { "0 9 * * mon-fri echo hi",         "2011-10-02 09:00", CRONTAB_LINE_RECORD, 0 },
+        { "0 9 * * sUnDaY echo hi",          "2011-10-02 09:00", CRONTAB_LINE_RECORD, 1 },
+        { "0 9 * * 7 echo hi",               "2011-10-02 09:00", CRONTAB_LINE_RECORD, 1 },
+        { "0 9 * * sat-sun echo hi",         "2011-10-02 09:00", CRONTAB_LINE_RECORD, 1 },
+        { "0 9 * nov-feb * echo hi",         "2011-01-02 09:00", CRONTAB_LINE_RECORD, 1 },
+        { "0 9 * nov-feb * echo hi",         "2011-10-02 09:00", CRONTAB_LINE_RECORD, 0 },
+        { "0 9 * janjan,marfeb * echo hi",   "2011-03-02 09:00", CRONTAB_LINE_RECORD, 1 },
+        { "0 9 * october * echo hi",         "2011-10-02 09:00", CRONTAB_LINE_RECORD, 1 },
+
+        /**
+         * If both mday and wday are restricted, either can match.
+         */
+        { "10 10 10 10 0 echo hi",           "2011-10-02 10:10", CRONTAB_LINE_RECORD, 1 },
+        { "10 10 10 10 0 echo hi",           "2011-10-10 10:10", CRONTAB_LINE_RECORD, 1 },
+        { "10 10 10 10 0 echo hi",           "2011-10-11 10:10", CRONTAB_LINE_RECORD, 0 },
+        { "10 10 10 * * echo hi",            "2011-10-02 10:10", CRONTAB_LINE_RECORD, 0 },
+
+        /**
+         * Shortcuts.
+         */
+        { "@hourly do my stuff",             "2011-10-03 05:00", CRONTAB_LINE_RECORD, 1 },
+        { "@hourly do my stuff",             "2011-10-03 05:01", CRONTAB_LINE_RECORD, 0 },
+        { "@daily do my stuff",              "2011-10-03 00:00", CRONTAB_LINE_RECORD, 1 },
+        { "@midnight do my stuff",           "2011-10-03 00:00", CRONTAB_LINE_RECORD, 1 },
+        { "@weekly do my stuff",             "2011-10-02 00:00", CRONTAB_LINE_RECORD, 1 },
+        { "@weekly do my stuff",             "2011-10-03 00:00", CRONTAB_LINE_RECORD, 0 },
+        { "@monthly do my stuff",            "2011-10-01 00:00", CRONTAB_LINE_RECORD, 1 },
+        { "@yearly do my stuff",             "2011-01-01 00:00", CRONTAB_LINE_RECORD, 1 },
+        { "@annually do my stuff",           "2011-10-01 00:00", CRONTAB_LINE_RECORD, 0 },
+
+        /**
+         * Errors.
+         */
+        { "*/5 * * * /usr/bin/php",          "2011-10-03 05:00", CRONTAB_LINE_ERROR, 0 },
+        { "60 * * * * echo hi",              "2011-10-03 05:00", CRONTAB_LINE_ERROR, 0 },
+        { "* 24 * * * echo hi",              "2011-10-03 05:00", CRONTAB_LINE_ERROR, 0 },
+        { "* * 0 * * echo hi",               "2011-10-03 05:00", CRONTAB_LINE_ERROR, 0 },
+        { "*/0 * * * * echo hi",             "2011-10-03 05:00", CRONTAB_LINE_ERROR, 0 },
+        { "1,,2 * * * * echo hi",            "2011-10-03 05:00", CRONTAB_LINE_ERROR, 0 },
+        { "* * * * fooday echo hi",          "2011-10-03 05:00", CRONTAB_LINE_ERROR, 0 },
+        { "* * * * *",                       "2011-10-03 05:00", CRONTAB_LINE_ERROR, 0 },
+    };
+
+
+  /**
+   * These are the next_due tests from tc_crontab.rb.
+   */
+    struct next_due_case next_due_tests[] = {
+        { "11 11 * 10 1 echo hi",        "2011-09-30 00:00", "2011-10-03 11:11" },
+        { "10 10 10 10 0 echo hi",       "2011-09-30 00:00", "2011-10-02 10:10" },
+        { "10 10 10 10 0 echo hi",       "2011-10-02 10:12", "2011-10-09 10:10" },
+        { "10 10 10 10 0 echo hi",       "2011-10-09 10:12", "2011-10-10 10:10" },
+        { "0 0 31 9 * echo hi",          "2011-09-30 00:00", NULL },
+        { "30 7 * * 5 /do/some/stuff",   "2014-01-15 17:00", "2014-01-17 07:30" },
+        { "20 0-23 * * * echo hi",       "2017-06-02 01:40", "2017-06-02 02:20" },
+        { "20 0-23 1-5 * * echo hi",     "2017-06-06 01:40", "2017-07-01 00:20" },
+        { "20 0-23 * * 1-5 echo hi",     "2017-06-10 01:40", "2017-06-12 00:20" },
+        { "20 0-23 * 1-5 * echo hi",     "2017-06-06 01:40", "2018-01-01 00:20" },
+        { "* * * * * echo hi",           "2017-06-06 01:40", "2017-06-06 01:40" },
+        { "0 0 29 2 * echo hi",          "2017-03-01 00:00", "2020-02-29 00:00" },
+    };
+
+  /**
+   * Current test.
+   */
+    int i = 0;
+    int count = sizeof (tests) / sizeof (tests[0]);
+
+  /**
+   * Test each struct.
+   */
+    while (i < count)
+    {
+        if (test_schedule (tests[i]))
+            printf ("[%d/%d] OK %s\n", i + 1, count, tests[i].line);
+
+        i++;
+    }
+
+    i = 0;
+    count = sizeof (next_due_tests) / sizeof (next_due_tests[0]);
+
+    while (i < count)
+    {
+        if (test_next_due (next_due_tests[i]))
+            printf ("[%d/%d] OK %s from %s\n", i + 1, count,
+                    next_due_tests[i].line, next_due_tests[i].from);
+
+        i++;
+    }
+
+    return 0;
+}
@@ -1,4 +1,6 @@
 require 'symbiosis/domain/dkim'
+require 'symbiosis/fingerprints'
+require 'symbiosis/host'
 
 module Symbiosis
 
@@ -95,6 +97,25 @@ module Symbiosis
       return nil
     end
 
+    #
+    # Returns a fingerprint of everything that goes into this domain's DNS
+    # data: the files in its config directory (IPs, TTL, MX, SPF, DKIM, DMARC
+    # and so on), the snippets in config/dns, and the template.  If a data
+    # directory is given, the copies of the snippets there are included too.
+    # The host's FQDN is included as the DKIM selector depends on it.  Any
+    # extra values given are also included.
+    #
+    def dns_fingerprint(template, data_dir = nil, *extras)
+      snippets = Dir.glob(File.join(self.config_dir, "dns", "*.txt")).sort
+
+      files  = Dir.glob(File.join(self.config_dir, "*")).sort
+      files += snippets
+      files << template
+      files += snippets.collect { |fn| File.join(data_dir, File.basename(fn)) } unless data_dir.nil?
+
+      Symbiosis::Fingerprints.digest(files, self.ips.collect { |ip| ip.to_s }, Symbiosis::Host.fqdn, *extras)
+    end
+
     private
 
     #
@@ -276,4 +276,37 @@ EOF
     assert_match(/^'_dmarc.#{Regexp.escape(@domain.name)}:v=DMARC1; p=reject; pct=100; rua=mailto\\072postmaster\\100dmarcdomain\.com:300$/,txt, "")
   end
 
+  def test_dns_fingerprint
+    @domain.__send__(:set_param, "ip", "80.68.88.52", @domain.config_dir)
+    fingerprint = @domain.dns_fingerprint(@dns_template)
+    assert_equal(fingerprint, @domain.dns_fingerprint(@dns_template))
+
+    #
+    # Changing the IP should change the fingerprint.
+    #
+    @domain.__send__(:set_param, "ip", "80.68.88.53", @domain.config_dir)
+    assert_not_equal(fingerprint, @domain.dns_fingerprint(@dns_template))
+
+    #
+    # As should a new snippet.
+    #
+    fingerprint = @domain.dns_fingerprint(@dns_template)
+    @domain.create_dir(File.join(@domain.config_dir, "dns"))
+    File.open(File.join(@domain.config_dir, "dns", "#{@domain.name}.txt"), "w") { |fh| fh.puts "# hello" }
+    assert_not_equal(fingerprint, @domain.dns_fingerprint(@dns_template))
+
+    #
+    # And changing the hostname, as the DKIM selector comes from it.
+    #
+    fingerprint = @domain.dns_fingerprint(@dns_template)
+    fqdn = Symbiosis::Host.method(:fqdn)
+
+    begin
+      Symbiosis::Host.define_singleton_method(:fqdn) { "renamed.example.net" }
+      assert_not_equal(fingerprint, @domain.dns_fingerprint(@dns_template))
+    ensure
+      Symbiosis::Host.define_singleton_method(:fqdn, fqdn)
+    end
+  end
+
 end
@@ -217,12 +217,15 @@ module Symbiosis
         #
         real_quota_definition = "" unless real_quota_definition.is_a?(String)
 
-        real_quota_definition.split(",").each do |qpart|
+        #
+        # The definition is the first line, padded with spaces.
+        #
+        real_quota_definition.split($/).first.to_s.strip.split(",").each do |qpart|
           case qpart
             when /^(\d+)S$/
-              real_size = $1
+              real_size = $1.to_i
             when /^(\d+)C$/
-              real_count = $1
+              real_count = $1.to_i
             else
               next
           end
@@ -251,7 +254,7 @@ module Symbiosis
             else
               begin
                 used_size += File.stat(fn).size
-              rescue Erro::ENOENT
+              rescue Errno::ENOENT
                 # do nothing
               end
             end
@@ -0,0 +1,111 @@
+module Symbiosis
+  module Email
+    #
+    # Reads and writes constant databases, in the format used by Exim's cdb
+    # lookups.  See http://cr.yp.to/cdb/cdb.txt.
+    #
+    # Lookups need a couple of reads whatever the size of the file, rather
+    # than a scan through every line, as with lsearch.
+    #
+    module CDB
+
+      #
+      # Returns the cdb hash of a string.
+      #
+      def self.cdb_hash(str)
+        h = 5381
+        str.each_byte { |c| h = (((h << 5) + h) ^ c) & 0xffffffff }
+        h
+      end
+
+      #
+      # Writes a hash of keys and values to filename.  The file is written to
+      # a temporary file first, and then renamed into place.  If mtime is
+      # given, the file's times are set to it.
+      #
+      def self.write(filename, pairs, mtime = nil)
+        tmp = File.join(File.dirname(filename), "." + File.basename(filename) + ".#{Process.pid}.tmp")
+
+        records = []
+        tables  = Array.new(256) { [] }
+        pos     = 2048
+
+        pairs.each do |key, value|
+          key   = key.to_s.b
+          value = value.to_s.b
+          h     = cdb_hash(key)
+
+          tables[h & 0xff] << [h, pos]
+          records << [key.length, value.length].pack("VV") + key + value
+          pos += 8 + key.length + value.length
+        end
+
+        header = String.new
+        slots  = []
+
+        tables.each do |entries|
+          n = entries.length * 2
+          header << [pos + slots.length*8, n].pack("VV")
+
+          table = Array.new(n) { [0, 0] }
+
+          entries.each do |h, p|
+            i = (h >> 8) % n
+            i = (i + 1) % n until table[i][1] == 0
+            table[i] = [h, p]
+          end
+
+          slots += table
+        end
+
+        File.open(tmp, File::WRONLY|File::CREAT|File::TRUNC|File::NOFOLLOW, 0644) do |fh|
+          fh.binmode
+          fh.write header
+          records.each { |r| fh.write r }
+          fh.write slots.flatten.pack("V*")
+        end
+
+        File.utime(mtime, mtime, tmp) unless mtime.nil?
+        File.rename(tmp, filename)
+
+        filename
+      rescue StandardError
+        File.unlink(tmp) if tmp and File.exist?(tmp)
+        raise
+      end
+
+      #
+      # Returns the first value for key in filename, or nil if it isn't there.
+      #
+      def self.lookup(filename, key)
+        key = key.to_s.b
+        h   = cdb_hash(key)
+
+        File.open(filename, "rb") do |fh|
+          fh.seek((h & 0xff) * 8)
+          tpos, n = fh.read(8).unpack("VV")
+          return nil if 0 == n
+
+          i = (h >> 8) % n
+
+          n.times do
+            fh.seek(tpos + i*8)
+            sh, rpos = fh.read(8).unpack("VV")
+            return nil if 0 == rpos
+
+            if sh == h
+              fh.seek(rpos)
+              klen, dlen = fh.read(8).unpack("VV")
+              return fh.read(dlen) if fh.read(klen) == key
+            end
+
+            i = (i + 1) % n
+          end
+        end
+
+        nil
+      end
+
+    end
+  end
+end
@@ -2,6 +2,8 @@ require 'eventmachine'
 require 'em/protocols/line_protocol'
 require 'symbiosis/domains'
 require 'symbiosis/domain/mailbox'
+require 'symbiosis/email/mailbox_cache'
+require 'symbiosis/email/maildirsize_queue'
 require 'symbiosis/host'
 require 'syslog'
 require 'json'
@@ -10,16 +12,57 @@ module Symbiosis
   module Email
     class DictHandler < EM::Connection
 
+      #
+      # How often to log the cache hit rate, in lookups.
+      #
+      STATS_EVERY = 1000
+
       def self.prefix=(p)
         @@prefix = p
+        @@cache = MailboxCache.new(p)
+        @@crypt_cache = Hash.new
+        @@crypt_mutex = Mutex.new
+      end
+
+      #
+      # Returns the mailbox cache.
+      #
+      def self.cache
+        @@cache
       end
 
       def self.syslog=(s)
         @@syslog = s
+        @@maildirsize_queue = MaildirsizeQueue.new(s)
+        @@maildirsize_running = false
+      end
+
+      #
+      # Returns the queue of mailboxes waiting to have their quota files
+      # checked.
+      #
+      def self.maildirsize_queue
+        @@maildirsize_queue
       end
 
       include EventMachine::Protocols::LineProtocol
 
+      #
+      # Connections are kept open, so Dovecot can send lots of lookups down
+      # each one, without waiting for the answers in between.  Lookups are
+      # done in EventMachine's thread pool, so a slow one doesn't hold up
+      # anyone else, and the answers are sent back in the order the lookups
+      # arrived.
+      #
+      def post_init
+        @replies = []
+        @closed  = false
+      end
+
+      def unbind
+        @closed = true
+      end
+
       def receive_line(l)
         case l
           # DICT_PROTOCOL_CMD_HELLO = 'H',
@@ -27,9 +70,8 @@ module Symbiosis
             do_hello(l)
           # DICT_PROTOCOL_CMD_LOOKUP = 'L', /* <key> */
           when /^L/
-            ans = do_lookup(l)
-            send_data ans
-            close_connection(true)
+            reply = queue_reply
+            EM.defer(proc { safe_lookup(l) }, proc { |ans| send_reply(reply, ans) })
 
           # DICT_PROTOCOL_CMD_ITERATE = 'I', /* <flags> <path> */
           # DICT_PROTOCOL_CMD_BEGIN = 'B', /* <id> */
@@ -41,14 +83,45 @@ module Symbiosis
           # DICT_PROTOCOL_CMD_APPEND = 'P', /* <id> <key> <value> */
           # DICT_PROTOCOL_CMD_ATOMIC_INC = 'A' /* <id> <key> <diff> */
           else
-            send_data "F\n"
+            send_reply(queue_reply, "F\n")
 
             # fail?
         end
       rescue StandardError => err
-        send_data "F\n"
+        send_reply(queue_reply, "F\n")
         syslog.warning "Caught #{err.to_s}"
-        close_connection(true)
+      end
+
+      #
+      # Reserves a place for an answer, so that answers go back in order.
+      #
+      def queue_reply
+        reply = [nil]
+        @replies << reply
+        reply
+      end
+
+      #
+      # Fills in an answer, and sends as many as are ready.
+      #
+      def send_reply(reply, ans)
+        reply[0] = ans
+
+        while @replies.first and @replies.first[0]
+          ans = @replies.shift[0]
+          send_data ans unless @closed
+        end
+      end
+
+      #
+      # Does a lookup, turning any error into a failure reply.  This is run
+      # in the thread pool.
+      #
+      def safe_lookup(l)
+        do_lookup(l)
+      rescue StandardError => err
+        syslog.warning "Caught #{err.to_s}"
+        "F\n"
       end
 
       def syslog
@@ -59,6 +132,10 @@ module Symbiosis
         @@prefix
       end
 
+      def cache
+        @@cache
+      end
+
       def do_hello(l)
         # log hello
       end
@@ -66,13 +143,59 @@ module Symbiosis
       def do_lookup(l)
         (namespace, type, username) = l[1..-1].split('/',3)
 
-        mailbox = Symbiosis::Domains.find_mailbox(username, prefix)
+        mailbox, response = cache.fetch(type, username) do |mb|
+          mb.nil? ? "N\n" : do_response(mb, type)
+        end
+
+        if cache.lookups % STATS_EVERY == 0
+          syslog.info cache.stats
+        end
 
         if mailbox.nil?
           syslog.info "Non-existent mailbox #{username.inspect}"
-          return "N\n"
+          return response
         end
 
+        #
+        # Make sure our mailbox quota is correct, but not while Dovecot is
+        # waiting for an answer.  The queue is looked after by the reactor
+        # thread.
+        #
+        EM.schedule { check_maildirsize(mailbox) }
+
+        return response
+      end
+
+      #
+      # Queues the mailbox to have its quota file checked, and starts
+      # working through the queue in the background if needed.
+      #
+      def check_maildirsize(mailbox)
+        @@maildirsize_queue.push(mailbox)
+        drain_maildirsize_queue
+      end
+
+      #
+      # Works through the queue in EventMachine's thread pool, one mailbox
+      # at a time.  If anything was added whilst that was going on, it goes
+      # round again.
+      #
+      def drain_maildirsize_queue
+        return if @@maildirsize_running or @@maildirsize_queue.empty?
+
+        @@maildirsize_running = true
+
+        EM.defer(proc { @@maildirsize_queue.drain }, proc { |count|
+          @@maildirsize_running = false
+          drain_maildirsize_queue
+        })
+      end
+
+      #
+      # Works out the response for a mailbox.  This is cached until the
+      # mailbox changes.
+      #
+      def do_response(mailbox, type)
         res = {
           'user' => mailbox.username,
           'home' => mailbox.directory,
@@ -87,30 +210,13 @@ module Symbiosis
           res['quota_rule'] = "*:bytes=#{mailbox.quota}"
         end
 
-        # Ugh
-        begin
-          #
-          # Make sure our mailbox quota is correct.
-          #
-          mailbox.rebuild_maildirsize
-        rescue StandardError => err
-          syslog.warning "Caught #{err.to_s} when trying to rebuild Maildir/maildirsize file for #{username}."
-        end
-
         if "passdb" == type
           # add userdb_ to each key in res
           passdb_res = {}
           res.collect{|k,v| passdb_res["userdb_#{k}"] = v}
 
           if mailbox.password
-            real_password = mailbox.password
-            if real_password =~ /^(\{(?:crypt|CRYPT)\})?(\$(?:1|2a|5|6)\$[a-zA-Z0-9.\/]{1,16}\$[a-zA-Z0-9\.\/]+)$/
-              password = real_password
-            else
-              password = mailbox.domain.crypt_password(real_password)
-            end
-
-            passdb_res["password"] = password
+            passdb_res["password"] = crypted_password(mailbox)
           end
 
           res = passdb_res
@@ -120,6 +226,46 @@ module Symbiosis
 
       end
 
+      #
+      # Returns the mailbox password, crypted.  Crypting is slow on purpose,
+      # so it is only done once each time a plaintext password changes.
+      #
+      # If the domain has password encryption turned on, the password file
+      # is updated with the crypted password.  Otherwise the crypted password
+      # is kept in memory until the password file changes.
+      #
+      def crypted_password(mailbox)
+        begin
+          stat = File.stat(mailbox.password_file)
+          key  = [stat.ino, stat.mtime, stat.size]
+        rescue SystemCallError
+          key  = nil
+        end
+
+        real_password = mailbox.password
+
+        if real_password =~ /^(\{(?:crypt|CRYPT)\})?(\$(?:1|2a|5|6)\$[a-zA-Z0-9.\/]{1,16}\$[a-zA-Z0-9\.\/]+)$/
+          return real_password
+        end
+
+        if mailbox.domain.should_encrypt_mailbox_passwords?
+          begin
+            mailbox.password = real_password
+            return mailbox.password
+          rescue StandardError => err
+            syslog.warning "Caught #{err.to_s} when trying to encrypt the password for #{mailbox.username}."
+          end
+        end
+
+        cached = @@crypt_mutex.synchronize { @@crypt_cache[mailbox.password_file] }
+        return cached.last if cached and cached.first == key and !key.nil?
+
+        password = mailbox.domain.crypt_password(real_password)
+        @@crypt_mutex.synchronize { @@crypt_cache[mailbox.password_file] = [key, password] }
+
+        password
+      end
+
     end
   end
 end
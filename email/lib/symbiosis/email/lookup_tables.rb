@@ -0,0 +1,183 @@
+require 'symbiosis/domain/mailbox'
+require 'symbiosis/email/cdb'
+
+module Symbiosis
+  module Email
+    #
+    # Compiles a domain's mail settings into cdb files for Exim to look up,
+    # rather than it having to read through the original files for every
+    # recipient.
+    #
+    #  config/aliases.cdb
+    #    Compiled from config/aliases.  Its mtime is set to that of the
+    #    aliases file, so Exim can tell if it is out of date, and use the
+    #    aliases file itself until it is compiled again.
+    #
+    #  config/mailbox-ratelimit.cdb
+    #    The rate limit for each mailbox that has one in
+    #    mailboxes/$local_part/ratelimit, plus the domain's default from
+    #    config/mailbox-ratelimit under the key "*".
+    #
+    # Keys are in lower case, as lsearch lookups are case-insensitive.
+    #
+    class LookupTables
+
+      #
+      # The rate limit used if a file doesn't contain a number, as in the
+      # Exim ACL.
+      #
+      DEFAULT_RATELIMIT = "100"
+
+      attr_reader :domain
+
+      #
+      # Parses an lsearch file, and returns a hash of keys and values.  Only
+      # the first value for each key is kept, as that is what lsearch would
+      # find.
+      #
+      def self.parse_lsearch(text)
+        pairs = Hash.new
+        key   = nil
+
+        text.each_line do |line|
+          line = line.chomp
+
+          #
+          # Skip comments and blank lines.
+          #
+          next if line =~ /\A\s*(#|\z)/
+
+          #
+          # Lines starting with white space continue the previous one.
+          #
+          if line =~ /\A\s/
+            pairs[key] += " " + line.strip if key
+            next
+          end
+
+          if line =~ /\A"((?:[^"\\]|\\.)*)"\s*:?\s*(.*)\z/
+            this_key, value = $1, $2
+            this_key = this_key.gsub(/\\(.)/, '\1')
+          elsif line =~ /\A([^:\s]+)\s*:?\s*(.*)\z/
+            this_key, value = $1, $2
+          else
+            key = nil
+            next
+          end
+
+          this_key = this_key.downcase
+
+          if pairs.has_key?(this_key)
+            key = nil
+          else
+            key = this_key
+            pairs[key] = value.strip
+          end
+        end
+
+        pairs
+      end
+
+      def initialize(domain)
+        @domain = domain
+      end
+
+      def aliases_file
+        File.join(domain.config_dir, "aliases")
+      end
+
+      def aliases_cdb
+        aliases_file + ".cdb"
+      end
+
+      def ratelimit_file
+        File.join(domain.config_dir, "mailbox-ratelimit")
+      end
+
+      def ratelimit_cdb
+        ratelimit_file + ".cdb"
+      end
+
+      #
+      # Returns all the files the tables are compiled from, including the
+      # mailboxes directory, so new mailbox rate limits are spotted.
+      #
+      def sources
+        [aliases_file, ratelimit_file, mailboxes_dir] + mailbox_ratelimit_files
+      end
+
+      #
+      # Returns a hash of the aliases, or nil if there is no aliases file.
+      #
+      def aliases
+        return nil unless File.file?(aliases_file)
+
+        self.class.parse_lsearch(File.read(aliases_file))
+      end
+
+      #
+      # Returns a hash of the rate limits for each mailbox, and the domain's
+      # default under "*", or nil if none are set.
+      #
+      def ratelimits
+        pairs = Hash.new
+
+        mailbox_ratelimit_files.each do |fn|
+          local_part = File.basename(File.dirname(fn)).downcase
+          pairs[local_part] = read_ratelimit(fn)
+        end
+
+        pairs["*"] = read_ratelimit(ratelimit_file) if File.file?(ratelimit_file)
+
+        pairs.empty? ? nil : pairs
+      end
+
+      #
+      # Writes the cdb files, or removes them if there's nothing to put in
+      # them.  Returns a list of the files written.
+      #
+      def compile
+        written = []
+
+        table = aliases
+        if table.nil?
+          remove(aliases_cdb)
+        else
+          CDB.write(aliases_cdb, table, File.mtime(aliases_file))
+          written << aliases_cdb
+        end
+
+        table = ratelimits
+        if table.nil?
+          remove(ratelimit_cdb)
+        else
+          CDB.write(ratelimit_cdb, table)
+          written << ratelimit_cdb
+        end
+
+        written
+      end
+
+      private
+
+      def mailboxes_dir
+        File.join(domain.directory, "mailboxes")
+      end
+
+      def mailbox_ratelimit_files
+        Dir.glob(File.join(mailboxes_dir, "*", "ratelimit")).sort.select do |fn|
+          File.file?(fn) and Symbiosis::Domain::Mailbox.valid_local_part?(File.basename(File.dirname(fn)))
+        end
+      end
+
+      def read_ratelimit(fn)
+        File.read(fn) =~ /([0-9]+)/ ? $1 : DEFAULT_RATELIMIT
+      end
+
+      def remove(fn)
+        File.unlink(fn) if File.exist?(fn)
+      end
+
+    end
+  end
+end
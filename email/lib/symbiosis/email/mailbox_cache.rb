@@ -0,0 +1,163 @@
+require 'symbiosis/domains'
+require 'symbiosis/domain/mailbox'
+require 'symbiosis/host'
+require 'thread'
+
+module Symbiosis
+  module Email
+    #
+    # Caches mailbox lookups, so that a burst of logins doesn't mean walking
+    # the domain and mailbox directories for each one.
+    #
+    # Each entry records the files and directories the answer depended on,
+    # and is thrown away as soon as any of them changes.  Checking that is a
+    # handful of stat calls, rather than a directory walk.
+    #
+    # It is safe to use from more than one thread.  The lookups themselves
+    # are done outside the lock, so one slow lookup doesn't hold up others.
+    #
+    class MailboxCache
+
+      #
+      # The number of hits and misses since the cache was created.
+      #
+      attr_reader :hits, :misses
+
+      #
+      # The maximum number of entries to keep.  Defaults to 10000.
+      #
+      attr_accessor :max_entries
+
+      attr_reader :prefix
+
+      def initialize(prefix = "/srv")
+        @prefix      = prefix
+        @entries     = Hash.new
+        @hits        = 0
+        @misses      = 0
+        @max_entries = 10000
+        @mutex       = Mutex.new
+      end
+
+      #
+      # Returns the mailbox for username, and the response for it.  If there
+      # is nothing in the cache, or the files it depends on have changed,
+      # the mailbox is looked up again, and passed to the block, which should
+      # return the response to cache.  The mailbox is nil if it wasn't found.
+      #
+      def fetch(key, username)
+        entry_key = [key, username]
+        entry = @mutex.synchronize { @entries.delete(entry_key) }
+
+        if entry and entry[:signature] == signature(entry[:files])
+          hit = true
+        else
+          hit = false
+
+          mailbox = Symbiosis::Domains.find_mailbox(username, @prefix)
+          files   = files_for(username, mailbox)
+
+          #
+          # Take the signature first, so that anything that changes while
+          # the response is worked out gets noticed next time.
+          #
+          entry = {
+            :mailbox   => mailbox,
+            :files     => files,
+            :signature => signature(files)
+          }
+          entry[:response] = yield(mailbox)
+        end
+
+        @mutex.synchronize do
+          hit ? @hits += 1 : @misses += 1
+
+          #
+          # Keep the most recently used entries at the end.
+          #
+          @entries[entry_key] = entry
+          @entries.shift while @entries.length > @max_entries
+        end
+
+        [entry[:mailbox], entry[:response]]
+      end
+
+      #
+      # Returns the total number of lookups.
+      #
+      def lookups
+        @mutex.synchronize { @hits + @misses }
+      end
+
+      #
+      # Returns the number of entries.
+      #
+      def size
+        @mutex.synchronize { @entries.size }
+      end
+
+      #
+      # Empties the cache.
+      #
+      def clear
+        @mutex.synchronize { @entries.clear }
+      end
+
+      #
+      # Returns a string summarising the hits and misses, for logging.
+      #
+      def stats
+        total = @hits + @misses
+        rate  = (total > 0 ? (100.0 * @hits / total).round : 0)
+        "mailbox cache: #{@hits} hits, #{@misses} misses (#{rate}% hit rate), #{size} entries"
+      end
+
+      private
+
+      #
+      # Returns the files and directories that the lookup for username
+      # depended on.
+      #
+      def files_for(username, mailbox)
+        files = [@prefix, "/etc/passwd"]
+
+        if mailbox.nil?
+          domain = username.to_s.downcase.split("@").last
+          domain = Symbiosis::Host.fqdn unless username.to_s.include?("@")
+
+          [domain, domain.to_s.sub(/^(.*\.)?www\./,"")].uniq.each do |name|
+            files << File.join(@prefix, name)
+            files << File.join(@prefix, name, "mailboxes")
+          end
+        else
+          domain = mailbox.domain
+
+          files << domain.directory
+          files << domain.config_dir
+          files << File.join(domain.config_dir, "mailbox-quota")
+          files << File.join(domain.config_dir, "mailbox-dont-encrypt-passwords")
+          files << File.join(domain.directory, mailbox.mailboxes_dir)
+          files << mailbox.directory
+          files << mailbox.password_file
+          files << File.join(mailbox.directory, mailbox.dot + "quota")
+        end
+
+        files
+      end
+
+      def signature(files)
+        files.collect do |file|
+          begin
+            stat = File.stat(file)
+            [stat.ino, stat.size, stat.mtime, stat.ctime]
+          rescue SystemCallError
+            nil
+          end
+        end
+      end
+
+    end
+
+  end
+
+end
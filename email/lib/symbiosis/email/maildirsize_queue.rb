@@ -0,0 +1,115 @@
+require 'thread'
+
+module Symbiosis
+  module Email
+    #
+    # Queues mailboxes whose Maildir/maildirsize file needs checking, so that
+    # it can be done in the background rather than while someone is waiting
+    # to log in.
+    #
+    # Each mailbox is only queued once at a time, and is not checked again
+    # until interval seconds after it was last checked.
+    #
+    class MaildirsizeQueue
+
+      #
+      # How long to wait, in seconds, before checking the same mailbox again.
+      # Defaults to 300.
+      #
+      attr_accessor :interval
+
+      #
+      # Where to log errors to.  Should respond to #warning.
+      #
+      attr_accessor :syslog
+
+      def initialize(syslog = nil)
+        @syslog   = syslog
+        @interval = 300
+        @queue    = []
+        @queued   = Hash.new
+        @checked  = Hash.new
+        @mutex    = Mutex.new
+      end
+
+      #
+      # Adds a mailbox to the queue.  Returns true if it was added, or false
+      # if it was already queued, or was checked too recently.
+      #
+      def push(mailbox, now = Time.now)
+        key = mailbox.directory
+
+        @mutex.synchronize do
+          return false if @queued.has_key?(key)
+          return false if @checked.has_key?(key) and now - @checked[key] < @interval
+
+          @queued[key] = true
+          @queue << mailbox
+        end
+
+        true
+      end
+
+      #
+      # Returns the number of mailboxes waiting to be checked.
+      #
+      def size
+        @mutex.synchronize { @queue.size }
+      end
+
+      #
+      # Returns true if there is nothing waiting to be checked.
+      #
+      def empty?
+        0 == size
+      end
+
+      #
+      # Checks each mailbox in the queue in turn, until it is empty.  Returns
+      # the number of mailboxes checked.
+      #
+      def drain(now = Time.now)
+        count = 0
+
+        loop do
+          mailbox = @mutex.synchronize do
+            mb = @queue.shift
+            unless mb.nil?
+              @queued.delete(mb.directory)
+              @checked[mb.directory] = now
+            end
+            mb
+          end
+
+          break if mailbox.nil?
+
+          begin
+            mailbox.rebuild_maildirsize
+          rescue StandardError => err
+            @syslog.warning "Caught #{err.to_s} when trying to rebuild Maildir/maildirsize file for #{mailbox.username}." if @syslog
+          end
+
+          count += 1
+        end
+
+        expire(now)
+
+        count
+      end
+
+      private
+
+      #
+      # Forget when mailboxes were checked, once it no longer matters.
+      #
+      def expire(now)
+        @mutex.synchronize do
+          @checked.delete_if { |key, checked| now - checked >= @interval }
+        end
+      end
+
+    end
+
+  end
+
+end
@@ -13,6 +13,11 @@ class TestEmailDictClient < EventMachine::Connection
   def initialize(q,r)
     @script = q
     @result = r
+    #
+    # The server keeps the connection open, so hang up once everything but
+    # the hellos has been answered.
+    #
+    @expected = q.join("\n").split(/\r?\n/).reject{|msg| msg =~ /^H/}.length
     msg = script.shift
     puts msg if $DEBUG
     send_data(msg+"\r\n")
@@ -21,7 +26,8 @@ class TestEmailDictClient < EventMachine::Connection
 
   def receive_data(l)
     puts l if $DEBUG
-    @result << l.chomp
+    l.split("\n").each { |line| @result << line.chomp }
+    close_connection if @result.length >= @expected
 
     unless script.empty?
       msg = script.shift
@@ -170,6 +176,65 @@ class TestEmailDictd < Test::Unit::TestCase
     assert_equal("*:bytes=1000000", hash["quota_rule"])
   end
 
+  def test_plaintext_password_encrypted
+    mailbox = @domain.create_mailbox("aarvo")
+    mailbox.encrypt_password = false
+    mailbox.password = "abc"
+
+    results = do_test_script(["L /passdb/#{mailbox.username}"])
+    hash = JSON.load(results.first[1..-1])
+
+    #
+    # The password file should have been upgraded.
+    #
+    assert_match(/^\{CRYPT\}\$6\$/, mailbox.password)
+    assert_equal(mailbox.password, hash["password"])
+    assert(@domain.check_password("abc", hash["password"]))
+  end
+
+  def test_plaintext_password_cached
+    Symbiosis::Utils.set_param("mailbox-dont-encrypt-passwords", "", @domain.config_dir)
+
+    mailbox = @domain.create_mailbox("aarvo")
+    mailbox.password = "abc"
+
+    passwords = 2.times.collect do
+      Symbiosis::Email::DictHandler.cache.clear
+      results = do_test_script(["L /passdb/#{mailbox.username}"])
+      JSON.load(results.first[1..-1])["password"]
+    end
+
+    #
+    # The password file should be left alone, and the same crypt used each
+    # time.
+    #
+    assert_equal("abc", mailbox.password)
+    assert_equal(passwords.first, passwords.last)
+    assert(@domain.check_password("abc", passwords.first))
+  end
+
+  def test_pipelined_lookups
+    mailbox = @domain.create_mailbox("aarvo")
+    mailbox.quota = "1M"
+
+    #
+    # Send all the lookups at once, and make sure the answers come back in
+    # the same order.
+    #
+    script = ["L /userdb/#{mailbox.username}",
+              "L /userdb/idonotexist@foo.com",
+              "X",
+              "L /userdb/#{mailbox.username}"].join("\r\n")
+
+    results = do_test_script([script])
+
+    assert_equal(4, results.length)
+    assert_equal("O", results[0][0])
+    assert_equal("N", results[1])
+    assert_equal("F", results[2])
+    assert_equal(results[0], results[3])
+  end
+
   def test_nonexistent_user
     results = do_test_script(["L /passdb/idonotexist@foo.com"])
     assert_equal("N", results.first[0])
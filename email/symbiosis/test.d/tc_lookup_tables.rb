@@ -0,0 +1,95 @@
+require 'symbiosis/email/lookup_tables'
+require 'test/unit'
+require 'tmpdir'
+
+class TestLookupTables < Test::Unit::TestCase
+
+  include Symbiosis::Email
+
+  def setup
+    @prefix = Dir.mktmpdir("srv")
+
+    File.chown(1000,1000,@prefix) if 0 == Process.uid
+
+    @domain = Symbiosis::Domain.new(nil, @prefix)
+    @domain.create
+
+    @tables = LookupTables.new(@domain)
+  end
+
+  def teardown
+    #
+    # Remove the @prefix directory
+    #
+    FileUtils.remove_entry_secure @prefix
+  end
+
+  def test_cdb
+    fn = File.join(@prefix, "test.cdb")
+    pairs = Hash[1000.times.collect { |i| ["key#{i}", "value#{i}"] }]
+    pairs["empty"] = ""
+
+    CDB.write(fn, pairs)
+
+    pairs.each do |k, v|
+      assert_equal(v, CDB.lookup(fn, k), "Wrong value for #{k}")
+    end
+
+    assert_nil(CDB.lookup(fn, "missing"))
+
+    CDB.write(fn, {})
+    assert_nil(CDB.lookup(fn, "key1"))
+  end
+
+  def test_parse_lsearch
+    text = <<EOF
+# A comment
+root: bob@example.com
+
+Postmaster:  bob@example.com,
+  alice@example.com
+"quoted key": |/usr/bin/something
+nocolon /dev/null
+root: ignored@example.com
+  ignored@example.org
+EOF
+
+    expected = {
+      "root"       => "bob@example.com",
+      "postmaster" => "bob@example.com, alice@example.com",
+      "quoted key" => "|/usr/bin/something",
+      "nocolon"    => "/dev/null",
+    }
+
+    assert_equal(expected, LookupTables.parse_lsearch(text))
+  end
+
+  def test_compile
+    assert_equal([], @tables.compile)
+
+    File.open(@tables.aliases_file, "w") { |fh| fh.puts "Bob: alice@example.com" }
+    File.utime(Time.now - 3600, Time.now - 3600, @tables.aliases_file)
+
+    @domain.create_mailbox("alice")
+    File.open(File.join(@domain.directory, "mailboxes", "alice", "ratelimit"), "w") { |fh| fh.puts "200" }
+
+    assert_equal([@tables.aliases_cdb, @tables.ratelimit_cdb], @tables.compile)
+
+    assert_equal("alice@example.com", CDB.lookup(@tables.aliases_cdb, "bob"))
+    assert_equal(File.mtime(@tables.aliases_file).to_i, File.mtime(@tables.aliases_cdb).to_i, "The cdb should have the same mtime as the aliases")
+
+    assert_equal("200", CDB.lookup(@tables.ratelimit_cdb, "alice"))
+    assert_nil(CDB.lookup(@tables.ratelimit_cdb, "*"))
+
+    #
+    # Set a default, and make sure the aliases cdb goes when the aliases do.
+    #
+    File.open(@tables.ratelimit_file, "w") { |fh| fh.puts "rubbish" }
+    File.unlink(@tables.aliases_file)
+
+    assert_equal([@tables.ratelimit_cdb], @tables.compile)
+    assert(!File.exist?(@tables.aliases_cdb))
+    assert_equal(LookupTables::DEFAULT_RATELIMIT, CDB.lookup(@tables.ratelimit_cdb, "*"))
+  end
+
+end
@@ -0,0 +1,97 @@
+require 'symbiosis/email/mailbox_cache'
+require 'test/unit'
+require 'tmpdir'
+
+class TestMailboxCache < Test::Unit::TestCase
+
+  def setup
+    @prefix = Dir.mktmpdir("srv")
+
+    File.chown(1000,1000,@prefix) if 0 == Process.uid
+
+    @domain = Symbiosis::Domain.new(nil, @prefix)
+    @domain.create
+
+    @cache = Symbiosis::Email::MailboxCache.new(@prefix)
+    @calls = 0
+  end
+
+  def teardown
+    #
+    # Remove the @prefix directory
+    #
+    FileUtils.remove_entry_secure @prefix
+  end
+
+  def do_fetch(username)
+    @cache.fetch("userdb", username) do |mailbox|
+      @calls += 1
+      mailbox.nil? ? nil : mailbox.password
+    end
+  end
+
+  def test_hits_and_misses
+    mailbox = @domain.create_mailbox("aarvo")
+    mailbox.encrypt_password = false
+    mailbox.password = "abc"
+
+    2.times do
+      mb, response = do_fetch(mailbox.username)
+      assert_equal(mailbox.username, mb.username)
+      assert_equal("abc", response)
+    end
+
+    assert_equal(1, @calls)
+    assert_equal(1, @cache.hits)
+    assert_equal(1, @cache.misses)
+
+    #
+    # Changing the password should invalidate the entry.
+    #
+    mailbox.password = "defgh"
+    mb, response = do_fetch(mailbox.username)
+    assert_equal("defgh", response)
+    assert_equal(2, @calls)
+
+    #
+    # Changing the quota should too.
+    #
+    mailbox.quota = "1M"
+    do_fetch(mailbox.username)
+    assert_equal(3, @calls)
+
+    do_fetch(mailbox.username)
+    assert_equal(3, @calls)
+  end
+
+  def test_nonexistent_mailbox
+    username = "aarvo@#{@domain.name}"
+
+    2.times do
+      mb, response = do_fetch(username)
+      assert_nil(mb)
+    end
+
+    assert_equal(1, @calls)
+
+    #
+    # Creating the mailbox should be noticed straight away.
+    #
+    @domain.create_mailbox("aarvo")
+    mb, response = do_fetch(username)
+    assert_equal(username, mb.username)
+    assert_equal(2, @calls)
+  end
+
+  def test_max_entries
+    @cache.max_entries = 2
+
+    %w(one two three).each do |lp|
+      do_fetch("#{lp}@#{@domain.name}")
+    end
+
+    assert_equal(2, @cache.size)
+    assert_match(/0 hits, 3 misses/, @cache.stats)
+  end
+
+end
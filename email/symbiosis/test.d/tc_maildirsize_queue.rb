@@ -0,0 +1,73 @@
+require 'symbiosis/email/maildirsize_queue'
+require 'symbiosis/domain/mailbox'
+require 'test/unit'
+require 'tmpdir'
+
+class TestMaildirsizeQueue < Test::Unit::TestCase
+
+  include Symbiosis::Email
+
+  def setup
+    @prefix = Dir.mktmpdir("srv")
+
+    File.chown(1000,1000,@prefix) if 0 == Process.uid
+
+    @domain = Symbiosis::Domain.new(nil, @prefix)
+    @domain.create
+  end
+
+  def teardown
+    #
+    # Remove the @prefix directory
+    #
+    FileUtils.remove_entry_secure @prefix
+  end
+
+  def test_push_and_drain
+    queue = MaildirsizeQueue.new
+    queue.interval = 60
+    now = Time.now
+
+    one = @domain.create_mailbox("one")
+    two = @domain.create_mailbox("two")
+
+    assert(queue.push(one, now))
+    assert(!queue.push(one, now), "Mailbox queued twice")
+    assert(queue.push(two, now))
+    assert_equal(2, queue.size)
+
+    assert_equal(2, queue.drain(now))
+    assert(queue.empty?)
+    assert(File.directory?(one.maildir))
+
+    #
+    # Not again until the interval has passed.
+    #
+    assert(!queue.push(one, now + 30))
+    assert(queue.push(one, now + 60))
+  end
+
+  def test_rebuild_maildirsize
+    mailbox = @domain.create_mailbox("aarvo")
+    mailbox.quota = "1M"
+    mailbox.rebuild_maildirsize
+
+    maildirsize = File.join(mailbox.maildir, "maildirsize")
+    assert_equal("1000000S,0C", File.readlines(maildirsize).first.strip)
+
+    #
+    # If nothing has changed, the file should be left alone.
+    #
+    ino = File.stat(maildirsize).ino
+    mailbox.rebuild_maildirsize
+    assert_equal(ino, File.stat(maildirsize).ino)
+
+    #
+    # But it should be redone when the quota changes.
+    #
+    mailbox.quota = "2M"
+    mailbox.rebuild_maildirsize
+    assert_equal("2000000S,0C", File.readlines(maildirsize).first.strip)
+  end
+
+end
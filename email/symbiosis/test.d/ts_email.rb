@@ -4,5 +4,8 @@ require "test/unit"
 require "tc_exim4"
 require "tc_poppassd"
 require "tc_dict_handler"
+require "tc_mailbox_cache"
+require "tc_maildirsize_queue"
+require "tc_lookup_tables"
 
 
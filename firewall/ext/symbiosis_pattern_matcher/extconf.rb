@@ -0,0 +1,2 @@
+require 'mkmf'
+create_makefile('symbiosis_pattern_matcher')
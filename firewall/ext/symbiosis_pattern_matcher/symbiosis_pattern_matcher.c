@@ -0,0 +1,660 @@
+#include <ruby.h>
+#include <ruby/re.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/*
+ * A multi-pattern matcher for firewall blacklist patterns.
+ *
+ * Every pattern has the longest literal string it requires pulled out of its
+ * source.  Those literals are compiled into a single Aho-Corasick automaton,
+ * so each log line is scanned once to find which patterns could possibly
+ * match.  Only those candidates are then handed to the regular expression
+ * engine to confirm the match and capture the __IP__ group.  Patterns with no
+ * usable literal are always tried.
+ */
+
+// Module and classes.
+static VALUE mSymbiosis;
+static VALUE mFirewall;
+static VALUE cPatternMatcher;
+
+struct pattern
+{
+  VALUE regexp;
+  VALUE group;
+  char *literal;
+  long literal_len;
+};
+
+struct matcher
+{
+  struct pattern *patterns;
+  long n_patterns;
+  long size;
+
+  /*
+   * The automaton.  Each state has a full row of 256 transitions, and a list
+   * of the patterns whose literal ends in that state.
+   */
+  int (*next)[256];
+  long **outputs;
+  long *n_outputs;
+  long n_states;
+  int compiled;
+
+  /*
+   * Per-pattern marker of the last line its literal was seen in.
+   */
+  unsigned long *seen;
+  unsigned long line_no;
+};
+
+static void
+matcher_free_automaton (struct matcher *m)
+{
+  long i;
+
+  for (i = 0; i < m->n_states; i++)
+    free (m->outputs[i]);
+
+  free (m->next);
+  free (m->outputs);
+  free (m->n_outputs);
+  free (m->seen);
+
+  m->next = NULL;
+  m->outputs = NULL;
+  m->n_outputs = NULL;
+  m->seen = NULL;
+  m->n_states = 0;
+  m->compiled = 0;
+}
+
+static void
+matcher_mark (void *ptr)
+{
+  struct matcher *m = ptr;
+  long i;
+
+  for (i = 0; i < m->n_patterns; i++)
+    {
+      rb_gc_mark (m->patterns[i].regexp);
+      rb_gc_mark (m->patterns[i].group);
+    }
+}
+
+static void
+matcher_free (void *ptr)
+{
+  struct matcher *m = ptr;
+  long i;
+
+  matcher_free_automaton (m);
+
+  for (i = 0; i < m->n_patterns; i++)
+    free (m->patterns[i].literal);
+
+  free (m->patterns);
+  free (m);
+}
+
+static const rb_data_type_t matcher_type = {
+  "Symbiosis::Firewall::PatternMatcher",
+  {matcher_mark, matcher_free, NULL,},
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE
+matcher_alloc (VALUE klass)
+{
+  struct matcher *m;
+
+  m = ALLOC (struct matcher);
+  memset (m, 0, sizeof (struct matcher));
+
+  return TypedData_Wrap_Struct (klass, &matcher_type, m);
+}
+
+/*
+ * Returns the number of bytes taken up by the escape sequence starting with
+ * the backslash at src[i], so that none of it is mistaken for literal text.
+ */
+static long
+escape_length (const char *src, long len, long i)
+{
+  long j = i + 1, n;
+  unsigned char e;
+
+  if (j >= len)
+    return 1;
+
+  e = (unsigned char) src[j++];
+
+  switch (e)
+    {
+    case 'x':
+      /* \xHH or \x{H...} */
+      if (j < len && src[j] == '{')
+	{
+	  while (j < len && src[j] != '}')
+	    j++;
+	  return (j < len ? j + 1 : j) - i;
+	}
+      for (n = 0; n < 2 && j < len && isxdigit ((unsigned char) src[j]); n++)
+	j++;
+      return j - i;
+
+    case 'u':
+      /* \uHHHH or \u{H...} */
+      if (j < len && src[j] == '{')
+	{
+	  while (j < len && src[j] != '}')
+	    j++;
+	  return (j < len ? j + 1 : j) - i;
+	}
+      for (n = 0; n < 4 && j < len && isxdigit ((unsigned char) src[j]); n++)
+	j++;
+      return j - i;
+
+    case 'p':
+    case 'P':
+    case 'k':
+    case 'g':
+      /* \p{Name}, \k<name>, \g'name' and so on */
+      if (j < len && (src[j] == '{' || src[j] == '<' || src[j] == '\''))
+	{
+	  char close = (src[j] == '{' ? '}' : (src[j] == '<' ? '>' : '\''));
+
+	  while (j < len && src[j] != close)
+	    j++;
+	  return (j < len ? j + 1 : j) - i;
+	}
+      return j - i;
+
+    case 'c':
+    case 'C':
+    case 'M':
+      /* \cX, \C-X and \M-X, where X may itself be an escape. */
+      if (e != 'c' && j < len && src[j] == '-')
+	j++;
+      if (j >= len)
+	return j - i;
+      if (src[j] == '\\')
+	return j - i + escape_length (src, len, j);
+      return j + 1 - i;
+
+    default:
+      /* Octal escapes and backreferences, e.g. \101 or \1 */
+      if (e >= '0' && e <= '7')
+	{
+	  for (n = 1; n < 3 && j < len && src[j] >= '0' && src[j] <= '7'; n++)
+	    j++;
+	}
+      return j - i;
+    }
+}
+
+/*
+ * Find the longest run of literal bytes that any match of the regexp source
+ * has to contain.  This errs on the side of caution: anything that is not
+ * obviously a plain character at the top level of the expression ends the
+ * current run, and alternation at the top level means there is no such
+ * literal at all.
+ *
+ * Returns the length of the literal, which is copied into *literal, or 0.
+ */
+static long
+required_literal (const char *src, long len, char **literal)
+{
+  char *run = ALLOCA_N (char, len + 1);
+  long run_len = 0, best_len = 0;
+  char *best = ALLOCA_N (char, len + 1);
+  long i = 0, depth = 0;
+  unsigned char c;
+
+#define FLUSH_RUN() do { \
+    if (run_len > best_len) { memcpy (best, run, run_len); best_len = run_len; } \
+    run_len = 0; \
+  } while (0)
+
+  while (i < len)
+    {
+      c = (unsigned char) src[i];
+
+      if (c == '\\')
+	{
+	  unsigned char e = (i + 1 < len) ? (unsigned char) src[i + 1] : 0;
+
+	  /*
+	   * Escaped punctuation is a literal character.  Everything else
+	   * (classes, anchors, backrefs, hex, octal and control characters)
+	   * is not, and the whole escape is skipped.
+	   */
+	  if (e != 0 && e < 0x80 && ispunct (e))
+	    {
+	      if (depth == 0)
+		run[run_len++] = e;
+	      i += 2;
+	    }
+	  else
+	    {
+	      FLUSH_RUN ();
+	      i += escape_length (src, len, i);
+	    }
+
+	  continue;
+	}
+
+      if (c == '[')
+	{
+	  /*
+	   * Skip over the whole character class, including nested classes.
+	   */
+	  long class_depth = 1;
+
+	  FLUSH_RUN ();
+	  i++;
+
+	  if (i < len && src[i] == '^')
+	    i++;
+	  if (i < len && src[i] == ']')
+	    i++;
+
+	  while (i < len && class_depth > 0)
+	    {
+	      if (src[i] == '\\')
+		i++;
+	      else if (src[i] == '[')
+		class_depth++;
+	      else if (src[i] == ']')
+		class_depth--;
+	      i++;
+	    }
+
+	  continue;
+	}
+
+      if (c == '(')
+	{
+	  /*
+	   * Inline options and comments change how everything else should be
+	   * read, so give up.
+	   */
+	  if (i + 2 < len && src[i + 1] == '?' &&
+	      (src[i + 2] == '#' || src[i + 2] == '-' || isalpha ((unsigned char) src[i + 2])))
+	    return 0;
+
+	  FLUSH_RUN ();
+	  depth++;
+	  i++;
+	  continue;
+	}
+
+      if (c == ')')
+	{
+	  FLUSH_RUN ();
+	  if (depth > 0)
+	    depth--;
+	  i++;
+	  continue;
+	}
+
+      if (c == '|')
+	{
+	  if (depth == 0)
+	    return 0;
+	  i++;
+	  continue;
+	}
+
+      if (c == '?' || c == '*' || c == '{')
+	{
+	  /*
+	   * The previous character is optional.
+	   */
+	  if (depth == 0 && run_len > 0)
+	    run_len--;
+	  FLUSH_RUN ();
+
+	  if (c == '{')
+	    {
+	      while (i < len && src[i] != '}')
+		i++;
+	    }
+
+	  i++;
+	  continue;
+	}
+
+      if (c == '+')
+	{
+	  /*
+	   * The previous character is needed once, but may be repeated.
+	   */
+	  FLUSH_RUN ();
+	  i++;
+	  continue;
+	}
+
+      if (depth > 0 || c == '.' || c == '^' || c == '$' || c >= 0x80 ||
+	  c == '\n' || c == '\r')
+	{
+	  FLUSH_RUN ();
+	  i++;
+	  continue;
+	}
+
+      run[run_len++] = c;
+      i++;
+    }
+
+  FLUSH_RUN ();
+
+#undef FLUSH_RUN
+
+  if (best_len > 0)
+    {
+      *literal = malloc (best_len);
+      if (*literal == NULL)
+	rb_raise (rb_eNoMemError, "failed to allocate pattern literal");
+      memcpy (*literal, best, best_len);
+    }
+
+  return best_len;
+}
+
+/*
+ * Add a pattern index to the outputs of a state.
+ */
+static void
+add_output (struct matcher *m, long state, long pattern)
+{
+  long *outputs = realloc (m->outputs[state],
+			   sizeof (long) * (m->n_outputs[state] + 1));
+
+  if (outputs == NULL)
+    rb_raise (rb_eNoMemError, "failed to allocate automaton");
+
+  outputs[m->n_outputs[state]++] = pattern;
+  m->outputs[state] = outputs;
+}
+
+/*
+ * Build the Aho-Corasick automaton from the pattern literals, and turn it into
+ * a DFA by filling in every transition from the failure links.
+ */
+static void
+matcher_compile (struct matcher *m)
+{
+  long max_states = 1, i, j, s, head = 0, tail = 0;
+  long *fail, *queue;
+  int c;
+
+  matcher_free_automaton (m);
+
+  for (i = 0; i < m->n_patterns; i++)
+    max_states += m->patterns[i].literal_len;
+
+  m->next = malloc (sizeof (*m->next) * max_states);
+  m->outputs = calloc (max_states, sizeof (long *));
+  m->n_outputs = calloc (max_states, sizeof (long));
+  m->seen = calloc (m->n_patterns + 1, sizeof (unsigned long));
+  fail = calloc (max_states, sizeof (long));
+  queue = calloc (max_states, sizeof (long));
+
+  if (m->next == NULL || m->outputs == NULL || m->n_outputs == NULL ||
+      m->seen == NULL || fail == NULL || queue == NULL)
+    {
+      free (fail);
+      free (queue);
+      rb_raise (rb_eNoMemError, "failed to allocate automaton");
+    }
+
+  m->line_no = 0;
+  m->n_states = 1;
+  memset (m->next[0], -1, sizeof (m->next[0]));
+
+  /*
+   * The trie.
+   */
+  for (i = 0; i < m->n_patterns; i++)
+    {
+      struct pattern *p = &m->patterns[i];
+
+      if (p->literal_len == 0)
+	continue;
+
+      s = 0;
+      for (j = 0; j < p->literal_len; j++)
+	{
+	  c = (unsigned char) p->literal[j];
+
+	  if (m->next[s][c] < 0)
+	    {
+	      memset (m->next[m->n_states], -1, sizeof (m->next[0]));
+	      m->next[s][c] = m->n_states++;
+	    }
+
+	  s = m->next[s][c];
+	}
+
+      add_output (m, s, i);
+    }
+
+  /*
+   * Breadth-first over the trie to set up the failure links.
+   */
+  for (c = 0; c < 256; c++)
+    {
+      if (m->next[0][c] < 0)
+	{
+	  m->next[0][c] = 0;
+	}
+      else
+	{
+	  fail[m->next[0][c]] = 0;
+	  queue[tail++] = m->next[0][c];
+	}
+    }
+
+  while (head < tail)
+    {
+      s = queue[head++];
+
+      for (i = 0; i < m->n_outputs[fail[s]]; i++)
+	add_output (m, s, m->outputs[fail[s]][i]);
+
+      for (c = 0; c < 256; c++)
+	{
+	  long t = m->next[s][c];
+
+	  if (t < 0)
+	    {
+	      m->next[s][c] = m->next[fail[s]][c];
+	    }
+	  else
+	    {
+	      fail[t] = m->next[fail[s]][c];
+	      queue[tail++] = t;
+	    }
+	}
+    }
+
+  free (fail);
+  free (queue);
+
+  m->compiled = 1;
+}
+
+/*
+ * Adds a regular expression to the matcher.  Hits for it are counted under
+ * group, which can be any object.
+ */
+static VALUE
+cPatternMatcher_add (VALUE self, VALUE regexp, VALUE group)
+{
+  struct matcher *m;
+  struct pattern *p;
+  VALUE source;
+
+  TypedData_Get_Struct (self, struct matcher, &matcher_type, m);
+
+  if (!RB_TYPE_P (regexp, T_REGEXP))
+    rb_raise (rb_eTypeError, "expected a Regexp");
+
+  if (m->n_patterns == m->size)
+    {
+      long size = m->size ? m->size * 2 : 8;
+      struct pattern *patterns =
+	realloc (m->patterns, sizeof (struct pattern) * size);
+
+      if (patterns == NULL)
+	rb_raise (rb_eNoMemError, "failed to allocate patterns");
+
+      m->patterns = patterns;
+      m->size = size;
+    }
+
+  p = &m->patterns[m->n_patterns];
+  p->regexp = regexp;
+  p->group = group;
+  p->literal = NULL;
+  p->literal_len = 0;
+
+  /*
+   * Case-insensitive and extended expressions don't have byte-for-byte
+   * literals, so those are always tried.
+   */
+  if ((rb_reg_options (regexp) & (ONIG_OPTION_IGNORECASE | ONIG_OPTION_EXTEND)) == 0)
+    {
+      source = rb_funcall (regexp, rb_intern ("source"), 0);
+      p->literal_len = required_literal (RSTRING_PTR (source),
+					 RSTRING_LEN (source), &p->literal);
+    }
+
+  m->n_patterns++;
+  m->compiled = 0;
+
+  return self;
+}
+
+/*
+ * Returns the literals that have been chosen for each pattern, with nil for
+ * patterns that are always tried.  Mostly useful for testing.
+ */
+static VALUE
+cPatternMatcher_literals (VALUE self)
+{
+  struct matcher *m;
+  VALUE result = rb_ary_new ();
+  long i;
+
+  TypedData_Get_Struct (self, struct matcher, &matcher_type, m);
+
+  for (i = 0; i < m->n_patterns; i++)
+    {
+      if (m->patterns[i].literal_len > 0)
+	rb_ary_push (result, rb_str_new (m->patterns[i].literal,
+					 m->patterns[i].literal_len));
+      else
+	rb_ary_push (result, Qnil);
+    }
+
+  return result;
+}
+
+/*
+ * Runs every line through the matcher.  Returns a hash keyed on group, each
+ * value being a hash of the captured IP strings and the number of times they
+ * were matched, e.g.
+ *
+ *  { group1 => { "1.2.3.4" => 3, "2001:db8::1" => 1 } }
+ *
+ * Every pattern that matches a line counts, not just the first.
+ */
+static VALUE
+cPatternMatcher_count (VALUE self, VALUE lines)
+{
+  struct matcher *m;
+  VALUE result = rb_hash_new ();
+  long i, j, k;
+
+  TypedData_Get_Struct (self, struct matcher, &matcher_type, m);
+
+  lines = rb_Array (lines);
+
+  if (!m->compiled)
+    matcher_compile (m);
+
+  for (i = 0; i < RARRAY_LEN (lines); i++)
+    {
+      VALUE line = rb_ary_entry (lines, i);
+      const unsigned char *ptr;
+      long len, s = 0;
+
+      StringValue (line);
+      ptr = (const unsigned char *) RSTRING_PTR (line);
+      len = RSTRING_LEN (line);
+
+      /*
+       * Scan the line once, noting which literals are in it.
+       */
+      m->line_no++;
+
+      for (j = 0; j < len; j++)
+	{
+	  s = m->next[s][ptr[j]];
+
+	  for (k = 0; k < m->n_outputs[s]; k++)
+	    m->seen[m->outputs[s][k]] = m->line_no;
+	}
+
+      /*
+       * And then confirm the candidates.
+       */
+      for (j = 0; j < m->n_patterns; j++)
+	{
+	  struct pattern *p = &m->patterns[j];
+	  VALUE ip, counts, hits;
+
+	  if (p->literal_len > 0 && m->seen[j] != m->line_no)
+	    continue;
+
+	  if (rb_reg_search (p->regexp, line, 0, 0) < 0)
+	    continue;
+
+	  ip = rb_reg_nth_match (1, rb_backref_get ());
+	  if (NIL_P (ip))
+	    continue;
+
+	  counts = rb_hash_lookup2 (result, p->group, Qnil);
+	  if (NIL_P (counts))
+	    {
+	      counts = rb_hash_new ();
+	      rb_hash_aset (result, p->group, counts);
+	    }
+
+	  hits = rb_hash_lookup2 (counts, ip, INT2FIX (0));
+	  rb_hash_aset (counts, ip, LONG2FIX (FIX2LONG (hits) + 1));
+	}
+    }
+
+  return result;
+}
+
+// Define module, classes and methods.
+void
+Init_symbiosis_pattern_matcher (void)
+{
+  mSymbiosis = rb_define_module ("Symbiosis");
+  mFirewall = rb_define_module_under (mSymbiosis, "Firewall");
+  cPatternMatcher =
+    rb_define_class_under (mFirewall, "PatternMatcher", rb_cObject);
+
+  rb_define_alloc_func (cPatternMatcher, matcher_alloc);
+  rb_define_method (cPatternMatcher, "add", cPatternMatcher_add, 2);
+  rb_define_method (cPatternMatcher, "count", cPatternMatcher_count, 1);
+  rb_define_method (cPatternMatcher, "literals", cPatternMatcher_literals, 0);
+}
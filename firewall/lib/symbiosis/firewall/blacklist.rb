@@ -2,6 +2,8 @@ require 'symbiosis/firewall/pattern'
 require 'symbiosis/firewall/directory'
 require 'symbiosis/firewall/blacklist_db'
 require 'symbiosis/firewall/logtail'
+require 'symbiosis/ipaddr'
+require 'symbiosis/utils'
 
 module Symbiosis
   module Firewall
@@ -74,6 +76,102 @@ module Symbiosis
         @block_all_after = a
       end
 
+      #
+      # Adds an IP to the blacklist directory, as a file named after the IP
+      # with ".auto" on the end containing the ports, one per line.  Any ports
+      # already blocked for that IP are kept.  IPv6 addresses are masked to
+      # /64s, and IPs that are not globally routable are ignored, as are IPs
+      # that have been blacklisted by hand.
+      #
+      # Returns true if the directory was changed.
+      #
+      def self.add_to_directory(ip, ports, blacklist_d, syslog = nil)
+        #
+        # Make sure we can parse stuff
+        #
+        begin
+          ip = Symbiosis::IPAddr.new(ip)
+        rescue ArgumentError => err
+          warn "Ignoring #{ip.inspect} because of #{err.to_s}"
+          return false
+        end
+
+        #
+        # Mask IPv6 to /64s.
+        #
+        ip = ip.mask(64) if ip.ipv6?
+
+        #
+        # Mask IPv4 to /32s.
+        #
+        ip = ip.mask(32) if ip.ipv4?
+
+        #
+        # Only include globally routable IPs.
+        #
+        # FIXME: Need better IPv6 conditions.
+        #
+        return false if ip.ipv4? and (Symbiosis::IPAddr.new("127.0.0.1/8").include?(ip) or Symbiosis::IPAddr.new("0.0.0.0") == ip )
+        return false if ip.ipv6? and !Symbiosis::IPAddr.new("2000::/3").include?(ip)
+
+        puts "Found IP address: #{ip}" if ( $VERBOSE )
+
+        setting = ip.to_s.gsub("/","|")
+
+        #
+        # Check filename without .auto first.
+        #
+        if Symbiosis::Utils.get_param(setting, blacklist_d)
+          puts "\tAlready manually blacklisted" if ( $VERBOSE )
+          return false
+        end
+
+        #
+        # Automatically blacklist.
+        #
+        setting += ".auto"
+
+        old_ports = Symbiosis::Utils.get_param(setting, blacklist_d)
+
+        if old_ports.is_a?(String) or true == old_ports
+
+          #
+          # Set old_ports to everything if it is just "true" (i.e. an empty file).
+          #
+          old_ports = "all" if true == old_ports
+          old_ports = old_ports.split($/).collect{|pt| pt.strip }
+
+          ports = (ports + old_ports).collect{|pt| pt.nil? ? "all" : pt.to_s }.uniq
+
+          ports = %w(all) if ports.any?{|pt| "all" == pt}
+
+          #
+          # Don't rewrite the file if nothing has changed, as that would
+          # trigger a reload of the blacklist for no reason.  Just bump the
+          # modification time so it doesn't get expired.
+          #
+          if ports.sort == old_ports.uniq.sort
+            puts "\tAlready blacklisted for #{ports.join(",")} ports" if $VERBOSE
+            now = Time.now
+            File.utime(now, now, File.join(blacklist_d, setting))
+            return false
+          end
+
+          puts "\tUpdating blacklist entry for #{ports.join(",")} ports" if  $VERBOSE
+          syslog.info "updating blacklisted IP #{ip} for #{ports.join(",")} ports" if syslog
+        else
+          #
+          # Add to the blacklist.
+          #
+          puts "\tAdding to blacklist for #{ports.join(",")} ports" if ( $VERBOSE )
+          syslog.info "adding #{ip} to blacklist for #{ports.join(",")} ports" if syslog
+        end
+
+        Symbiosis::Utils.set_param(setting, ports.join("\n"), blacklist_d)
+
+        true
+      end
+
       private
 
       def do_read
@@ -81,7 +179,7 @@ module Symbiosis
           @patterns << Pattern.new(entry)
         end
 
-        logfiles = Hash.new
+        logfiles = Hash.new{|h,k| h[k] = []}
         results = Hash.new{|h,k| h[k] = Hash.new{|i,l| i[l] = 0}}
 
         @patterns.each do |pattern|
@@ -90,40 +188,43 @@ module Symbiosis
             next
           end
 
+          logfiles[pattern.logfile] << pattern
+        end
+
+        logfiles.each do |logfile, patterns|
           #
-          # Read the log file, if needed.
+          # Apply all the patterns for this file in one go.
           #
-          unless logfiles.has_key?(pattern.logfile)
-            loglines = []
-
-            begin
-              logtail = Logtail.new(pattern.logfile, @logtail_db)
-              loglines = logtail.readlines
-            rescue Errno::ENOENT
-              #
-              # Do nothing if the log file doesn't exist.
-              #
+          matcher = PatternMatcher.new
+          patterns.each { |pattern| pattern.add_to(matcher) }
+          counts = Hash.new{|h,k| h[k] = Hash.new(0)}
+
+          #
+          # Read the new lines from the log file a batch at a time.
+          #
+          begin
+            logtail = Logtail.new(logfile, @logtail_db)
+            logtail.each_batch do |loglines|
+              matcher.count(loglines).each do |pattern, ips|
+                ips.each { |ip, hits| counts[pattern][ip] += hits }
+              end
             end
+          rescue Errno::ENOENT
             #
-            # Cache the log lines that we found
+            # Do nothing if the log file doesn't exist.
             #
-            logfiles[pattern.logfile] = loglines
-          else
-            loglines = logfiles[pattern.logfile]
           end
 
+          patterns.each do |pattern|
+            new_results = pattern.tally(counts.fetch(pattern, nil))
 
-          #
-          # Apply our pattern
-          #
-          new_results = pattern.apply(loglines)
-
-          #
-          # And add it on to our results.
-          #
-          new_results.each do |ip, ports|
-            ports.each do |port, hits|
-             results[ip][port] += hits
+            #
+            # And add it on to our results.
+            #
+            new_results.each do |ip, ports|
+              ports.each do |port, hits|
+               results[ip][port] += hits
+              end
             end
           end
         end
@@ -138,6 +239,7 @@ module Symbiosis
         #
         blacklist = Hash.new{|h,k| h[k] = []}
         timestamp = Time.now.to_i
+        totals = Hash.new
 
         results.each do |ip, ports|
           #
@@ -151,23 +253,24 @@ module Symbiosis
             blacklist[ip] << port if hits > @block_after
           end
 
-          #
-          # Record our count
-          #
-          @count_db.set_count_for(ip, total_for_ip, timestamp)
+          totals[ip] = total_for_ip
+        end
 
-          #
-          # Get the hits for the last 24 hours
-          #
-          total_for_ip = @count_db.get_count_for(ip, timestamp - 86400)
+        #
+        # Record our counts
+        #
+        @count_db.set_counts(totals, timestamp)
 
+        #
+        # Get the hits for the last 24 hours
+        #
+        @count_db.get_counts(totals.keys, timestamp - 86400).each do |ip, total_for_ip|
           #
           # If an IP has exceeded the number of matches, block it from all ports.
           #
           if total_for_ip > @block_all_after
             blacklist[ip] = %w(all)
           end
-
         end
 
         blacklist
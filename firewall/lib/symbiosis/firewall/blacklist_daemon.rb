@@ -0,0 +1,268 @@
+require 'symbiosis/firewall/blacklist'
+require 'symbiosis/firewall/sliding_window'
+
+begin
+  require 'rb-inotify'
+rescue LoadError
+  #
+  # We'll poll the log files instead.
+  #
+end
+
+module Symbiosis
+  module Firewall
+    #
+    # Follows the log files named in the blacklist patterns, and blocks IPs as
+    # soon as they go over the limits, rather than waiting for the next cron
+    # run.
+    #
+    # Hits are counted in memory over two sliding windows.  An IP is blocked
+    # from a port once it has more than block_after hits for that port in
+    # port_window seconds, and from all ports once it has more than
+    # block_all_after hits in total in all_window seconds.
+    #
+    class BlacklistDaemon
+
+      attr_reader :base_dir, :block_after, :block_all_after, :port_window, :all_window
+
+      #
+      # The name of the logtail database.  This is shared with
+      # symbiosis-firewall-blacklist, so switching between the two carries on
+      # from the same place in each log.
+      #
+      attr_accessor :logtail_db
+
+      #
+      # How often to check the logs when inotify isn't available, in seconds.
+      # Defaults to 5.
+      #
+      attr_accessor :interval
+
+      #
+      # Where to log blocks to.  Should respond to #info.
+      #
+      attr_accessor :syslog
+
+      def initialize(base_dir = '/etc/symbiosis/firewall')
+        @base_dir        = base_dir
+        @block_after     = 25
+        @block_all_after = 100
+        @port_window     = 15*60
+        @all_window      = 24*60*60
+        @logtail_db      = '/var/lib/symbiosis/firewall-blacklist-logtail.db'
+        @interval        = 5
+        @syslog          = nil
+        @logfiles        = nil
+        @reload          = false
+      end
+
+      def block_after=(a)
+        raise ArgumentError, "#{a.inspect} must be an integer" unless a.is_a?(Integer)
+        @block_after = a
+      end
+
+      def block_all_after=(a)
+        raise ArgumentError, "#{a.inspect} must be an integer" unless a.is_a?(Integer)
+        @block_all_after = a
+      end
+
+      def port_window=(w)
+        raise ArgumentError, "#{w.inspect} must be an integer" unless w.is_a?(Integer)
+        @port_window = w
+      end
+
+      def all_window=(w)
+        raise ArgumentError, "#{w.inspect} must be an integer" unless w.is_a?(Integer)
+        @all_window = w
+      end
+
+      def blacklist_d
+        File.join(@base_dir, "blacklist.d")
+      end
+
+      #
+      # Reads the patterns, and sets up one matcher per log file.  This resets
+      # all the counters.
+      #
+      def load_patterns
+        @logfiles  = Hash.new{|h,k| h[k] = []}
+        @matchers  = Hash.new
+        @stats     = Hash.new
+        @blocked   = Hash.new
+        @port_hits = SlidingWindow.new(@port_window)
+        @all_hits  = SlidingWindow.new(@all_window)
+
+        Dir.glob(File.join(@base_dir, "patterns.d", "*.patterns")).sort.each do |entry|
+          pattern = Pattern.new(entry)
+
+          if pattern.logfile.nil?
+            puts "No logfile set in #{pattern.filename} -- ignoring." if $VERBOSE
+            next
+          end
+
+          @logfiles[pattern.logfile] << pattern
+        end
+
+        @logfiles.each do |logfile, patterns|
+          matcher = PatternMatcher.new
+          patterns.each { |pattern| pattern.add_to(matcher) }
+          @matchers[logfile] = matcher
+        end
+
+        @logfiles.keys
+      end
+
+      #
+      # Reads any new lines in the log files, and adds any IPs that have gone
+      # over the limits to the blacklist directory.  Returns a hash of the IPs
+      # blocked, and their ports.
+      #
+      def check(now = Time.now)
+        load_patterns if @logfiles.nil?
+
+        blocks = Hash.new{|h,k| h[k] = []}
+
+        @logfiles.each do |logfile, patterns|
+          next unless changed?(logfile)
+
+          begin
+            Logtail.new(logfile, @logtail_db).each_batch do |lines|
+              counts = @matchers[logfile].count(lines)
+
+              patterns.each do |pattern|
+                pattern.tally(counts[pattern]).each do |ip, ports|
+                  ports.each do |port, hits|
+                    record(ip, port, hits, now, blocks)
+                  end
+                end
+              end
+            end
+          rescue Errno::ENOENT
+            #
+            # Do nothing if the log file doesn't exist.
+            #
+          end
+        end
+
+        blocks.each do |ip, ports|
+          Blacklist.add_to_directory(ip, ports, blacklist_d, @syslog)
+        end
+
+        blocks
+      end
+
+      #
+      # Forgets about IPs that have had no hits in the last all_window
+      # seconds.
+      #
+      def expire(now = Time.now)
+        return if @logfiles.nil?
+
+        @port_hits.expire(now)
+        @all_hits.expire(now).each { |ip| @blocked.delete(ip) }
+      end
+
+      #
+      # Runs for ever.  Sending SIGHUP re-reads the patterns.
+      #
+      def run
+        Signal.trap("HUP") { @reload = true }
+
+        load_patterns
+        notifier = watch
+        last_expiry = Time.now
+
+        loop do
+          if @reload
+            @reload = false
+            notifier.close if notifier
+            load_patterns
+            notifier = watch
+          end
+
+          check
+
+          if Time.now - last_expiry > 3600
+            expire
+            last_expiry = Time.now
+          end
+
+          wait(notifier)
+        end
+      end
+
+      private
+
+      #
+      # Counts the hits for an IP and port, and notes it in blocks if it has
+      # gone over either limit for the first time.
+      #
+      def record(ip, port, hits, now, blocks)
+        port_total = @port_hits.add([ip, port], hits, now)
+        all_total  = @all_hits.add(ip, hits, now)
+        blocked    = (@blocked[ip] ||= [])
+
+        return if blocked.include?("all")
+
+        if all_total > @block_all_after
+          blocked.replace(%w(all))
+          blocks[ip] = %w(all)
+
+        elsif port_total > @block_after and !blocked.include?(port)
+          blocked << port
+          blocks[ip] << port
+        end
+      end
+
+      #
+      # Checks to see if a log file has changed since we last looked, by
+      # device, inode, and size.
+      #
+      def changed?(logfile)
+        stat = File.stat(logfile)
+        key  = [stat.dev, stat.ino, stat.size]
+
+        return false if @stats[logfile] == key
+
+        @stats[logfile] = key
+        true
+      rescue Errno::ENOENT
+        false
+      end
+
+      #
+      # Sets up inotify watches on the directories holding the log files, so
+      # that we notice both writes and rotation.  Returns nil if inotify isn't
+      # available.
+      #
+      def watch
+        return nil unless defined?(INotify::Notifier)
+
+        notifier = INotify::Notifier.new
+
+        @logfiles.keys.collect{|logfile| File.dirname(logfile)}.uniq.each do |dir|
+          begin
+            notifier.watch(dir, :modify, :create, :moved_to) { }
+          rescue SystemCallError => err
+            puts "Unable to watch #{dir} -- #{err.to_s}" if $VERBOSE
+          end
+        end
+
+        notifier
+      end
+
+      def wait(notifier)
+        if notifier
+          notifier.process if IO.select([notifier.to_io], nil, nil, @interval)
+        else
+          sleep @interval
+        end
+      rescue Errno::EINTR
+        # Woken by a signal.
+      end
+
+    end
+
+  end
+
+end
@@ -2,52 +2,130 @@ require 'sqlite3'
 
 module Symbiosis
   module Firewall
+    #
+    # Records how many times each IP has been matched.  Counts are kept in
+    # hourly buckets, one row per IP per hour, and buckets older than the
+    # retention period are removed as new counts come in, so the database
+    # stays the same size however long it has been running.
+    #
     class BlacklistDB
 
+      #
+      # The size of each bucket, in seconds.
+      #
+      BUCKET_SIZE = 3600
+
       attr_reader :filename
       #
       # For testing.
       attr_reader :dbh
 
+      #
+      # How long counts are kept for, in seconds.  Defaults to 48 hours.
+      #
+      attr_accessor :retention
+
       def initialize(database = '/var/lib/symbiosis/firewall-blacklist.db')
         #
         # hmm.. maybe we should deal with this a bit better?
         #
         @dbh = SQLite3::Database.new(database)
-        @tbl_name = "blacklist"
+        @tbl_name = "blacklist_hourly"
+        @retention = 48*3600
         create_table
       end
-      
+
       def set_count_for(ip, cnt, timestamp = Time.now)
-        @dbh.execute("INSERT INTO #{@tbl_name}
-          VALUES (?, ?, ?)",
-          [ip.to_s, timestamp.to_i, cnt]
-        )
+        set_counts({ip => cnt}, timestamp)
 
         @count = cnt
       end
 
+      #
+      # Returns the count for an IP since timestamp.  This includes the whole
+      # of the hour that timestamp falls in.
+      #
       def get_count_for(ip, timestamp = (Time.now - 48*3600))
-        cnt = @dbh.execute("SELECT SUM(count) FROM #{@tbl_name} 
-          WHERE ip = ?  AND timestamp >= ?", 
-          [ip.to_s, timestamp.to_i]).flatten.first
+        get_counts([ip], timestamp)[ip]
+      end
+
+      #
+      # Adds the counts from a hash of IPs and counts, all in one transaction,
+      # and then expires any buckets past the retention period.
+      #
+      def set_counts(counts, timestamp = Time.now)
+        bucket = timestamp.to_i / BUCKET_SIZE
+
+        @dbh.transaction do
+          counts.each do |ip, cnt|
+            @dbh.execute("INSERT OR IGNORE INTO #{@tbl_name}
+              VALUES (?, ?, 0)", [ip.to_s, bucket])
+
+            @dbh.execute("UPDATE #{@tbl_name} SET count = count + ?
+              WHERE ip = ? AND bucket = ?", [cnt.to_i, ip.to_s, bucket])
+          end
+
+          @dbh.execute("DELETE FROM #{@tbl_name} WHERE bucket < ?",
+            [(timestamp.to_i - @retention) / BUCKET_SIZE])
+        end
 
-        return cnt.to_i
+        counts
       end
-      
+
+      #
+      # Returns a hash of the counts for each of ips since timestamp.
+      #
+      def get_counts(ips, timestamp = (Time.now - 48*3600))
+        bucket = timestamp.to_i / BUCKET_SIZE
+        results = Hash.new
+
+        @dbh.transaction do
+          ips.each do |ip|
+            cnt = @dbh.execute("SELECT SUM(count) FROM #{@tbl_name}
+              WHERE ip = ? AND bucket >= ?",
+              [ip.to_s, bucket]).flatten.first
+
+            results[ip] = cnt.to_i
+          end
+        end
+
+        results
+      end
+
       private
-      
+
+      #
+      # Creates the SQLite table.  The primary key covers the per-IP lookups,
+      # and the bucket index makes expiry cheap.
       #
-      # Creates the SQLite table.
+      # Counts from the old one-row-per-run table are folded into buckets
+      # the first time through.
       #
       def create_table
-        sql = "CREATE TABLE IF NOT EXISTS #{@tbl_name} 
-              (
-                ip         TEXT NOT NULL,
-                timestamp  INTEGER NOT NULL,
-                count      INTEGER NOT NULL
-              )"
-        @dbh.execute(sql)
+        @dbh.transaction do
+          @dbh.execute("CREATE TABLE IF NOT EXISTS #{@tbl_name}
+                (
+                  ip         TEXT NOT NULL,
+                  bucket     INTEGER NOT NULL,
+                  count      INTEGER NOT NULL,
+                  PRIMARY KEY (ip, bucket)
+                ) WITHOUT ROWID")
+
+          @dbh.execute("CREATE INDEX IF NOT EXISTS #{@tbl_name}_bucket
+                ON #{@tbl_name} (bucket)")
+
+          old = @dbh.execute("SELECT name FROM sqlite_master
+                WHERE type = 'table' AND name = 'blacklist'")
+
+          unless old.empty?
+            @dbh.execute("INSERT OR IGNORE INTO #{@tbl_name}
+                SELECT ip, timestamp / #{BUCKET_SIZE}, SUM(count) FROM blacklist
+                WHERE timestamp >= ? GROUP BY ip, timestamp / #{BUCKET_SIZE}",
+                [Time.now.to_i - @retention])
+
+            @dbh.execute("DROP TABLE blacklist")
+          end
+        end
       end
 
     end
@@ -55,4 +133,3 @@ module Symbiosis
   end
 
 end
-
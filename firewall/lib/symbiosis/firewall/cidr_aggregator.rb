@@ -0,0 +1,200 @@
+require 'symbiosis/ipaddr'
+
+module Symbiosis
+  module Firewall
+    #
+    # Merges lists of addresses and ranges into as few CIDR ranges as
+    # possible, using a binary prefix trie for each address family.
+    #
+    # By default only ranges that cover exactly the same addresses are
+    # produced, e.g. 192.0.2.0/25 and 192.0.2.128/25 become 192.0.2.0/24.
+    #
+    # A collapse policy can also be set, so that a whole range is listed once
+    # enough entries inside it have been added, e.g.
+    #
+    #  agg.collapse("inet", 24, 4)
+    #
+    # will list 192.0.2.0/24 once four or more addresses within it have been
+    # added.
+    #
+    class CIDRAggregator
+
+      FAMILIES = {
+        "inet"  => [Socket::AF_INET, 32],
+        "inet6" => [Socket::AF_INET6, 128]
+      }
+
+      #
+      # Parses a collapse policy, one rule per line, each giving the address
+      # family, the prefix length, and the number of entries needed, e.g.
+      #
+      #  inet 24 4
+      #  inet6 48 8
+      #
+      # Blank lines and comments are ignored.  Returns a hash like
+      #
+      #  { "inet" => { 24 => 4 }, "inet6" => { 48 => 8 } }
+      #
+      def self.parse_policy(str)
+        policy = Hash.new{|h,k| h[k] = Hash.new}
+
+        str.to_s.split($/).each do |line|
+          line = line.sub(/#.*/,"").strip
+          next if line.empty?
+
+          unless line =~ /\A(inet6?)\s+\/?(\d+)\s+(\d+)\z/
+            warn "Ignoring bad collapse rule #{line.inspect}"
+            next
+          end
+
+          policy[$1][$2.to_i] = $3.to_i
+        end
+
+        policy
+      end
+
+      #
+      # A hash of collapse rules, keyed on address family, and then prefix
+      # length.
+      #
+      attr_reader :policy
+
+      def initialize(policy = {})
+        @policy = Hash.new{|h,k| h[k] = Hash.new}
+        @tries  = Hash.new
+
+        policy.each do |family, rules|
+          rules.each { |prefixlen, threshold| collapse(family, prefixlen, threshold) }
+        end
+      end
+
+      #
+      # List the whole of any range of the given prefix length once threshold
+      # entries inside it have been added.
+      #
+      def collapse(family, prefixlen, threshold)
+        raise ArgumentError, "Unknown address family #{family.inspect}" unless FAMILIES.has_key?(family)
+
+        bits = FAMILIES[family].last
+        raise ArgumentError, "#{prefixlen.inspect} must be an integer between 1 and #{bits}" unless prefixlen.is_a?(Integer) and prefixlen.between?(1, bits)
+        raise ArgumentError, "#{threshold.inspect} must be a positive integer" unless threshold.is_a?(Integer) and threshold > 0
+
+        @policy[family][prefixlen] = threshold
+      end
+
+      #
+      # Adds an address or range.  Returns false if it was already covered by
+      # something that has been added before.
+      #
+      def add(address)
+        address = Symbiosis::IPAddr.new(address.to_s) unless address.is_a?(Symbiosis::IPAddr)
+        family  = (address.ipv4? ? "inet" : "inet6")
+        bits    = FAMILIES[family].last
+        value   = address.to_i
+        len     = address.prefixlen
+
+        #
+        # Each node is [zero, one, full, count], where count is the number of
+        # entries added beneath it.
+        #
+        root = (@tries[family] ||= new_node)
+
+        #
+        # Check to see if this is already covered.
+        #
+        node = root
+        len.times do |depth|
+          return false if node[2]
+          node = node[(value >> (bits - depth - 1)) & 1]
+          break if node.nil?
+        end
+        return false if node and node[2]
+
+        path = []
+        node = root
+        len.times do |depth|
+          path << node
+          bit = (value >> (bits - depth - 1)) & 1
+          node = (node[bit] ||= new_node)
+        end
+
+        #
+        # This entry replaces anything already added beneath it, so those
+        # entries no longer count towards the ranges above.
+        #
+        delta = 1 - node[3]
+        path.each { |n| n[3] += delta }
+
+        node[3] = 1
+        node[2] = true
+        node[0] = node[1] = nil
+
+        true
+      end
+
+      #
+      # Returns the aggregated list of ranges, sorted by family and address.
+      #
+      def aggregate
+        results = []
+
+        %w(inet inet6).each do |family|
+          root = @tries[family]
+          next if root.nil?
+
+          af, bits = FAMILIES[family]
+          rules = @policy.has_key?(family) ? @policy[family] : {}
+
+          merge(root, 0, rules)
+          walk(root, 0, 0, bits) do |value, len|
+            results << Symbiosis::IPAddr.new(value, af).mask(len)
+          end
+        end
+
+        results
+      end
+
+      private
+
+      def new_node
+        [nil, nil, false, 0]
+      end
+
+      #
+      # Marks nodes as full if both their children are full, or if the
+      # policy says so.  Returns true if the node is full.
+      #
+      def merge(node, depth, rules)
+        return false if node.nil?
+        return true if node[2]
+
+        zero = merge(node[0], depth + 1, rules)
+        one  = merge(node[1], depth + 1, rules)
+
+        threshold = rules[depth]
+
+        if (zero and one) or (threshold and node[3] >= threshold)
+          node[2] = true
+          node[0] = node[1] = nil
+        end
+
+        node[2]
+      end
+
+      def walk(node, value, depth, bits, &block)
+        return if node.nil?
+
+        if node[2]
+          yield value, depth
+          return
+        end
+
+        walk(node[0], value, depth + 1, bits, &block)
+        walk(node[1], value | (1 << (bits - depth - 1)), depth + 1, bits, &block)
+      end
+
+    end
+
+  end
+
+end
@@ -1,4 +1,6 @@
 require 'symbiosis/firewall/template'
+require 'symbiosis/firewall/cidr_aggregator'
+require 'symbiosis/firewall/resolver'
 require 'symbiosis/domain'
 require 'resolv-replace'
 
@@ -15,6 +17,22 @@ module Symbiosis
 
       attr_reader :direction, :chain, :path, :default
 
+      #
+      # Returns the resolver used to look up hostnames.  This is shared by
+      # all directories, so each name is only looked up once per run.
+      #
+      def self.resolver
+        @@resolver ||= Resolver.new
+      end
+
+      #
+      # Set the resolver used to look up hostnames.
+      #
+      def self.resolver=(r)
+        raise ArgumentError, "#{r.inspect} is not a Resolver" unless r.is_a?(Resolver)
+        @@resolver = r
+      end
+
       #
       # path::      directory where the rules are
       # direction:: either _incoming_ or _outgoing_
@@ -70,9 +88,12 @@ module Symbiosis
         rules << "#"*72
 
         #
-        # Read the rules, and generate.
+        # Read the rules, look up all the hostnames in one go, and generate.
         #
-        do_read.each do |template, hostnames|
+        templates = do_read
+        do_prefetch(templates.collect{|template, hostnames| hostnames}.flatten)
+
+        templates.each do |template, hostnames|
           rules += do_generate_rules( template, hostnames )
         end
 
@@ -141,6 +162,25 @@ module Symbiosis
         return rules
       end
 
+      #
+      # Looks up all the hostnames that aren't IP addresses at once, so that
+      # the answers are in the cache by the time the rules are generated.
+      #
+      def do_prefetch(hostnames)
+        names = hostnames.select do |hostname|
+          next false unless hostname.is_a?(String)
+
+          begin
+            IPAddr.new(hostname)
+            false
+          rescue ArgumentError
+            true
+          end
+        end
+
+        Directory.resolver.resolve(names) unless names.empty?
+      end
+
       #
       # Resolve hostnames to A and AAAA records.
       #
@@ -149,7 +189,6 @@ module Symbiosis
       # AAAA records available.
       #
       def do_resolve_name(name)
-        ips = []
         ip = nil
 
         return [] if name.nil?
@@ -168,37 +207,12 @@ module Symbiosis
         end
 
         return [ip] unless ip.nil? 
+        return [] unless name.is_a?(String)
 
         #
         # If we've not managed to turn the argument into an IP, try some DNS.
         #
-        Resolv::DNS.open do |dns|
-          %w(A AAAA).each do |type|
-            #
-            # This works with CNAME records too, depending on what the
-            # resolver gives us.
-            #
-            stuff = []
-            begin
-              stuff = dns.getresources(name, Resolv::DNS::Resource::IN.const_get(type))
-            rescue StandardError => e
-              warn "#{name} could not be resolved because #{e.message}." if $VERBOSE
-            end
-            
-            #
-            # Convert to IPAddr straight away, ignoring errors.
-            #
-            stuff.each do |a|
-              begin
-                ips << IPAddr.new(a.address.to_s)
-              rescue ArgumentError
-                warn "#{type} record for #{name} returned duff IP #{a.address.to_s.inspect}." if $VERBOSE
-              end
-            end
-          end
-        end
-
-        ips
+        Directory.resolver.lookup(name)
       end
 
     end
@@ -346,8 +360,309 @@ module Symbiosis
     #
     class IPListDirectory < Directory
 
+      #
+      # The iptables target used by the rules generated for ipsets.  Defaults
+      # to DROP.
+      #
+      attr_reader :target
+
+      #
+      # The collapse policy used when aggregating addresses.  See
+      # CIDRAggregator.parse_policy.
+      #
+      attr_reader :collapse
+
+      def initialize(path, direction, chain = nil)
+        super
+        @target = "DROP"
+        @collapse = {}
+      end
+
+      #
+      # Set the collapse policy, either as a hash, or as a string in the
+      # format taken by CIDRAggregator.parse_policy.
+      #
+      def collapse=(policy)
+        policy = CIDRAggregator.parse_policy(policy) unless policy.is_a?(Hash)
+
+        #
+        # Check the policy is OK.
+        #
+        CIDRAggregator.new(policy)
+        @collapse = policy
+      end
+
+      #
+      # Reads the collapse policy from a file, if it exists.
+      #
+      def read_collapse(filename)
+        self.collapse = File.read(filename) if File.exist?(filename)
+      end
+
+      #
+      # Merges an array of addresses into as few ranges as possible, using
+      # the collapse policy.
+      #
+      def aggregate(addresses)
+        aggregator = CIDRAggregator.new(self.collapse)
+        addresses.each { |address| aggregator.add(address) }
+        aggregator.aggregate
+      end
+
+      #
+      # Set the iptables target for ipset rules.
+      #
+      def target=(t)
+        raise ArgumentError, "Bad target #{t.inspect}" unless t.to_s =~ /\A[A-Za-z0-9_-]+\z/
+        @target = t.to_s
+      end
+
+      #
+      # Returns a hash of addresses, keyed on address family and port, e.g.
+      #
+      #  {
+      #    ["inet", nil] => [ address1, address2 ],
+      #    ["inet", 22]  => [ address3 ],
+      #    ["inet6", nil] => [ address4 ]
+      #  }
+      #
+      # A nil port means all ports.
+      #
+      def ipsets
+        sets = Hash.new{|h,k| h[k] = []}
+
+        templates = do_read
+        do_prefetch(templates.collect{|template, hostnames| hostnames}.flatten)
+
+        templates.each do |template, hostnames|
+          hostnames.each do |hostname|
+            do_resolve_name(hostname).each do |address|
+              family = (address.ipv4? ? "inet" : "inet6")
+              next unless Template.address_families.include?(family)
+
+              sets[[family, template.port]] << address
+            end
+          end
+        end
+
+        sets.each { |k, addresses| addresses.replace(aggregate(addresses)) }
+        sets
+      end
+
+      #
+      # Returns the name of the ipset for a family and port, e.g.
+      # blacklist-4-all or blacklist-6-22.
+      #
+      def ipset_name(family, port)
+        [(self.chain || self.default), ("inet" == family ? "4" : "6"), (port.nil? ? "all" : port.to_s)].join("-")
+      end
+
+      #
+      # Returns input for "ipset restore" that brings each set up to date.
+      #
+      # current is a hash of the sets already loaded, as returned by
+      # #current_ipsets.  Sets that are already loaded just have the changed
+      # addresses added or deleted, so the cost of a reload depends on how
+      # much has changed, not on how long the list is.  Other sets are filled
+      # under a temporary name and then swapped in, so a set is never seen
+      # half-full.
+      #
+      def ipset_restore(sets = self.ipsets, current = nil)
+        lines = []
+
+        sort_ipsets(sets).each do |family, port|
+          name = ipset_name(family, port)
+          addresses = []
+
+          sets[[family, port]].each do |address|
+            if 0 == address.prefixlen
+              warn "Ignoring #{address.to_s}/0 in #{self.path} -- ipset can't hold it."
+              next
+            end
+
+            addresses << address.to_s
+          end
+
+          if current.is_a?(Hash) and current.has_key?(name)
+            (current[name] - addresses).each do |address|
+              lines << "del #{name} #{address} -exist"
+            end
+
+            (addresses - current[name]).each do |address|
+              lines << "add #{name} #{address} -exist"
+            end
+          else
+            lines << "create #{name} hash:net family #{family} -exist"
+            lines << "create #{name}-new hash:net family #{family} -exist"
+            lines << "flush #{name}-new"
+
+            addresses.each do |address|
+              lines << "add #{name}-new #{address} -exist"
+            end
+
+            lines << "swap #{name}-new #{name}"
+            lines << "destroy #{name}-new"
+          end
+        end
+
+        lines.join("\n")
+      end
+
+      #
+      # Returns the names of the sets in current that are no longer needed,
+      # e.g. because the last address for a port has been removed.  These
+      # can only be destroyed once the chain no longer refers to them.
+      #
+      def obsolete_ipsets(sets = self.ipsets, current = nil)
+        return [] unless current.is_a?(Hash)
+
+        wanted = sets.keys.collect{|family, port| ipset_name(family, port)}
+        families = Template.address_families.collect{|family| "inet" == family ? "4" : "6"}
+
+        current.keys.select do |name|
+          name =~ ipset_name_regexp and families.include?($1) and !wanted.include?(name)
+        end.sort
+      end
+
+      #
+      # Returns a hash of the addresses in the sets for this chain that are
+      # currently loaded, keyed on set name, by asking ipset.  Returns nil if
+      # this can't be done, e.g. ipset isn't installed, or we're not root.
+      #
+      def current_ipsets
+        output = IO.popen(%w(/sbin/ipset save), :err => File::NULL) { |io| io.read }
+        return nil unless $?.success?
+
+        parse_ipset_save(output)
+      rescue SystemCallError => err
+        warn "Unable to list the current ipsets -- #{err.to_s}" if $VERBOSE
+        nil
+      end
+
+      #
+      # Parses the output of "ipset save" into a hash of addresses, keyed on
+      # set name.  Only sets belonging to this chain are returned.
+      #
+      def parse_ipset_save(output)
+        current = Hash.new
+
+        output.each_line do |line|
+          cmd, name, address = line.split(/\s+/)
+          next unless name =~ ipset_name_regexp
+
+          case cmd
+            when "create"
+              current[name] ||= []
+            when "add"
+              begin
+                address = IPAddr.new(address).to_s
+              rescue ArgumentError
+                # Leave it as it is.
+              end
+
+              (current[name] ||= []) << address
+          end
+        end
+
+        current
+      end
+
+      #
+      # Returns input for "iptables-restore --noflush" (or ip6tables-restore)
+      # that replaces the contents of our chain with one rule per ipset.
+      #
+      def iptables_restore(family, sets = self.ipsets)
+        chain = (self.chain || self.default)
+        flag  = ("incoming" == self.direction ? "src" : "dst")
+
+        lines = []
+        lines << "*filter"
+        lines << ":#{chain} - [0:0]"
+
+        sort_ipsets(sets).each do |set_family, port|
+          next unless family == set_family
+
+          match = "-m set --match-set #{ipset_name(set_family, port)} #{flag} -j #{self.target}"
+
+          if port.nil?
+            lines << "-A #{chain} #{match}"
+          else
+            %w(tcp udp).each do |proto|
+              lines << "-A #{chain} -p #{proto} --dport #{port} #{match}"
+            end
+          end
+        end
+
+        lines << "COMMIT"
+        lines.join("\n")
+      end
+
+      #
+      # Returns a shell snippet that updates the ipsets, and then loads the
+      # chain for each of the iptables commands given, each in a single
+      # batch.  This is used in place of #to_s when ipset is available.
+      #
+      def to_ipset_s(iptables_cmds = Template.iptables_cmds, current = self.current_ipsets)
+        sets = self.ipsets
+
+        rules = []
+        rules << "#"*72
+        rules << "#"
+        rules << "# Rules from #{path}, using ipset"
+        rules << "#"
+        rules << "#"*72
+
+        restore = ipset_restore(sets, current)
+
+        unless restore.empty?
+          rules << "/sbin/ipset restore <<'EOF'"
+          rules << restore
+          rules << "EOF"
+        end
+
+        iptables_cmds.each do |cmd|
+          family = (cmd =~ /ip6tables$/ ? "inet6" : "inet")
+
+          rules << "#{cmd}-restore --noflush <<'EOF'"
+          rules << iptables_restore(family, sets)
+          rules << "EOF"
+        end
+
+        obsolete = obsolete_ipsets(sets, current)
+
+        unless obsolete.empty?
+          rules << "/sbin/ipset restore <<'EOF'"
+          obsolete.each { |name| rules << "destroy #{name}" }
+          rules << "EOF"
+        end
+
+        rules.join("\n")
+      end
+
       private
 
+      #
+      # Resolves the hostnames, and then aggregates the addresses before
+      # generating the rules, so that there is one rule per range.
+      #
+      def do_generate_rules(template, hostnames)
+        addresses = []
+
+        hostnames.each do |hostname|
+          addresses += do_resolve_name(hostname)
+        end
+
+        super(template, aggregate(addresses))
+      end
+
+      def sort_ipsets(sets)
+        sets.keys.sort_by{|family, port| [family, port.nil? ? -1 : port]}
+      end
+
+      def ipset_name_regexp
+        /\A#{Regexp.escape(self.chain || self.default)}-([46])-(all|\d+)\z/
+      end
+
       #
       # Returns an array like
       #
@@ -5,6 +5,16 @@ module Symbiosis
   module Firewall
     class Logtail
 
+      #
+      # How much of the file to read at once.
+      #
+      CHUNK_SIZE = 1024 * 1024
+
+      #
+      # The default number of lines passed to each_batch at once.
+      #
+      BATCH_SIZE = 10000
+
       attr_reader :filename
       #
       # For testing.
@@ -16,36 +26,28 @@ module Symbiosis
         #
         raise Errno::ENOENT, file unless File.exist?(file)
         @filename = file
-        @pos = nil 
+        @pos = nil
         @identifier = nil
-        @lines = []
+        @rotated = nil
+        @lines = nil
 
         @dbh = SQLite3::Database.new(database)
         @tbl_name = "logtail"
         create_table
       end
-      
+
 
       #
-      # Returns the hash of the first line, or nil if no first line can be found. 
+      # Returns the device and inode of the file, as a string.  This is what
+      # the position is recorded against, so a rotated log is spotted as soon
+      # as a new file appears in its place.
       #
       def identifier
         return @identifier unless @identifier.nil?
 
-        line = nil
-        File.open(self.filename) do |fh|
-          line = fh.gets
-        end
-
-        if line.is_a?(String)
-          @identifier = Digest::MD5.new.hexdigest(line)
-        else
-          @identifier = nil
-        end
-
-        @identifier
+        @identifier = identifier_for(File.stat(self.filename))
       end
-      
+
       def pos=(new_pos)
         @dbh.execute("INSERT OR REPLACE INTO #{@tbl_name}
           VALUES (?, ?, ?)",
@@ -55,63 +57,161 @@ module Symbiosis
         @pos = new_pos
       end
 
+      #
+      # Returns the offset to start reading from.  This is zero if the file
+      # has not been seen before, has been rotated, or has been truncated.
+      #
       def pos
-        return 0 if self.identifier.nil?
         return @pos unless @pos.nil?
 
-        pos = @dbh.execute("SELECT pos FROM #{@tbl_name}
-          WHERE filename = ? AND identifier = ? LIMIT 0,1", 
-          [self.filename, self.identifier]).flatten.first
+        old_identifier, old_pos = @dbh.execute("SELECT identifier, pos FROM #{@tbl_name}
+          WHERE filename = ? LIMIT 0,1",
+          [self.filename]).first
+
+        pos = 0
+
+        if old_identifier.nil?
+          # never seen it before.
+
+        elsif old_identifier == self.identifier or legacy_identifier?(old_identifier)
+          pos = old_pos.to_i
 
-        pos = 0 if pos.nil?
-        @pos = pos.to_i
+        else
+          #
+          # The file has been rotated.  If the old file is still about, read
+          # what was added to it since last time.
+          #
+          rotated = "#{self.filename}.1"
+          if File.exist?(rotated) and identifier_for(File.stat(rotated)) == old_identifier
+            @rotated = [rotated, old_pos.to_i]
+          end
+        end
+
+        #
+        # Start again if the file has been truncated.
+        #
+        pos = 0 if pos > File.size(self.filename)
+
+        @pos = pos
       end
-      
+
+      #
+      # Reads the lines added to the file since last time, and passes them to
+      # the block in arrays of up to batch_size lines.  Lines are read in large
+      # chunks and are never all held in memory at once.  Invalid UTF-8 is
+      # removed.
+      #
+      # A last line with no newline is left until it is finished.  The new
+      # position is recorded once all the lines have been read.
+      #
+      def each_batch(batch_size = BATCH_SIZE, &block)
+        return enum_for(:each_batch, batch_size) unless block_given?
+
+        start = self.pos
+
+        if @rotated
+          rotated, rotated_pos = @rotated
+          read_from(rotated, rotated_pos, batch_size, true, &block)
+          @rotated = nil
+        end
+
+        self.pos = read_from(self.filename, start, batch_size, false, &block)
+      end
+
+      #
+      # Passes each new line to the block in turn.
+      #
+      def each_line
+        return enum_for(:each_line) unless block_given?
+
+        each_batch do |lines|
+          lines.each { |line| yield line }
+        end
+      end
+
+      #
+      # Returns all the new lines as an array.  Use #each_batch or
+      # #each_line for large files.
+      #
       def readlines
-        return @lines unless @lines.empty?
-        return @lines if self.identifier.nil?
-
-        File.open(self.filename) do |fh|
-          fh.pos = self.pos
-
-          while !fh.eof? 
-            untrusted_line = fh.gets
-            if untrusted_line.respond_to?(:valid_encoding?)
-              untrusted_line.force_encoding(Encoding::UTF_8)
-              trusted_line = if untrusted_line.valid_encoding?
-                untrusted_line
-              else
-                untrusted_line.force_encoding(Encoding::ASCII_8BIT).
-                  encode(Encoding::UTF_8,
-                    :invalid => :replace,
-                    :undef => :replace,
-                    :replace => '')
+        return @lines unless @lines.nil?
+
+        @lines = []
+        each_batch { |lines| @lines.concat(lines) }
+        @lines
+      end
+
+      private
+
+      def identifier_for(stat)
+        [stat.dev, stat.ino].join(":")
+      end
+
+      #
+      # Older versions identified files by the MD5 of their first line.  Honour
+      # those positions once, so nothing is re-read on upgrade.
+      #
+      def legacy_identifier?(old_identifier)
+        return false unless old_identifier =~ /\A[0-9a-f]{32}\z/
+
+        line = File.open(self.filename) { |fh| fh.gets }
+        line.is_a?(String) and Digest::MD5.new.hexdigest(line) == old_identifier
+      end
+
+      #
+      # Reads the file from offset to the end, yielding batches of lines.
+      # Returns the offset of the end of the last line read.  If to_end is
+      # true, a final line without a newline is included.
+      #
+      def read_from(file, offset, batch_size, to_end)
+        batch = []
+        partial = nil
+
+        File.open(file, "rb") do |fh|
+          fh.pos = offset
+
+          while (chunk = fh.read(CHUNK_SIZE))
+            chunk = partial + chunk unless partial.nil?
+            partial = nil
+
+            chunk.each_line do |line|
+              unless line.end_with?("\n")
+                partial = line
+                break
               end
-            else
-              require 'iconv'
 
-              ic ||= Iconv.new('UTF-8//IGNORE', 'UTF-8')
-              trusted_line = ic.iconv(untrusted_line + ' ')[0..-2]
+              offset += line.bytesize
+              batch << trust(line)
+
+              if batch.length >= batch_size
+                yield batch
+                batch = []
+              end
             end
-            @lines << trusted_line
           end
+        end
 
-          #
-          # Record the position
-          #
-          self.pos=fh.pos
+        if to_end and !partial.nil?
+          offset += partial.bytesize
+          batch << trust(partial)
         end
 
-        @lines
+        yield batch unless batch.empty?
+
+        offset
+      end
+
+      def trust(line)
+        line.force_encoding(Encoding::UTF_8)
+        line.scrub!('') unless line.valid_encoding?
+        line
       end
 
-      private
-      
       #
       # Creates the SQLite table.
       #
       def create_table
-        sql = "CREATE TABLE IF NOT EXISTS #{@tbl_name} 
+        sql = "CREATE TABLE IF NOT EXISTS #{@tbl_name}
               (
                 filename   TEXT NOT NULL UNIQUE,
                 identifier TEXT NOT NULL,
@@ -1,11 +1,12 @@
 
 require 'symbiosis/ipaddr'
+require 'symbiosis/firewall/pattern_matcher'
 
 module Symbiosis
   module Firewall
     class Pattern
 
-      attr_reader :logfile, :filename
+      attr_reader :logfile, :filename, :patterns, :ports
 
       def initialize(filename)
         @logfile  = nil
@@ -70,30 +71,48 @@ module Symbiosis
       #
       #
       def apply(lines)
+        tally(add_to(PatternMatcher.new).count(lines)[self])
+      end
+
+      #
+      # Adds our patterns to a PatternMatcher, so that patterns from several
+      # files for the same logfile can all be applied in one pass.  Hits are
+      # counted against this Pattern.
+      #
+      def add_to(matcher)
+        @patterns.each do |pattern|
+          matcher.add(pattern, self)
+        end
+
+        matcher
+      end
+
+      #
+      # Takes the hits counted for this pattern by a PatternMatcher, and
+      # returns them in the same form as #apply.
+      #
+      def tally(counts)
         # This returns a has of IPs summed up.
         results = Hash.new{|h,k| h[k] = Hash.new{|i,l| i[l] = 0 }}
 
-        lines.each do |line|
-          @patterns.each do |pattern|
-            next unless line =~ pattern
-            ip = $1
+        return results if counts.nil?
 
-            begin
-              ip = IPAddr.new(ip)
-            rescue ArgumentError
-              puts "Failed to parse IP #{ip.inspect} (from #{line.inspect})." if $VERBOSE
-            end
+        counts.each do |ip, hits|
+          begin
+            ip = IPAddr.new(ip)
+          rescue ArgumentError
+            puts "Failed to parse IP #{ip.inspect}." if $VERBOSE
+          end
 
-            next unless ip.is_a?(IPAddr)
+          next unless ip.is_a?(IPAddr)
 
-            #
-            # Only apply /64 for ipv6 addresses.
-            #
-            ip = ip.mask( 64 ) if ip.ipv6?
+          #
+          # Only apply /64 for ipv6 addresses.
+          #
+          ip = ip.mask( 64 ) if ip.ipv6?
 
-            @ports.each do |port|
-              results[ip.to_s][port] += 1
-            end
+          @ports.each do |port|
+            results[ip.to_s][port] += hits
           end
         end
 
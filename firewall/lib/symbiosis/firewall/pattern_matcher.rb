@@ -0,0 +1,57 @@
+module Symbiosis
+  module Firewall
+
+    #
+    # This is the pure-ruby version of the matcher in the
+    # symbiosis_pattern_matcher extension.  It is used if the extension cannot
+    # be loaded, and has exactly the same interface.
+    #
+    class RubyPatternMatcher
+
+      def initialize
+        @patterns = []
+      end
+
+      #
+      # Adds a regular expression to the matcher.  Hits for it are counted
+      # under group, which can be any object.
+      #
+      def add(regexp, group)
+        raise TypeError, "expected a Regexp" unless regexp.is_a?(Regexp)
+        @patterns << [regexp, group]
+        self
+      end
+
+      #
+      # Runs every line through the matcher.  Returns a hash keyed on group,
+      # each value being a hash of the captured IP strings and the number of
+      # times they were matched, e.g.
+      #
+      #  { group1 => { "1.2.3.4" => 3, "2001:db8::1" => 1 } }
+      #
+      def count(lines)
+        results = Hash.new
+
+        lines.each do |line|
+          @patterns.each do |regexp, group|
+            next unless line =~ regexp
+            next if $1.nil?
+
+            counts = (results[group] ||= Hash.new)
+            counts[$1] = counts.fetch($1, 0) + 1
+          end
+        end
+
+        results
+      end
+
+    end
+
+  end
+end
+
+begin
+  require 'symbiosis_pattern_matcher'
+rescue LoadError
+  Symbiosis::Firewall::PatternMatcher = Symbiosis::Firewall::RubyPatternMatcher
+end
@@ -0,0 +1,240 @@
+require 'symbiosis/ipaddr'
+require 'resolv'
+require 'sqlite3'
+
+module Symbiosis
+  module Firewall
+    #
+    # Resolves hostnames to addresses for the firewall rules.  Names are
+    # looked up several at a time, within an overall time limit, and the
+    # answers are cached for as long as their TTL allows.
+    #
+    # If a name can't be resolved in time, the last answer for it is used
+    # instead, however old, so that one broken nameserver doesn't stop the
+    # firewall from loading.
+    #
+    class Resolver
+
+      #
+      # How long, in seconds, all the lookups in one go are allowed to take.
+      # Defaults to 10.
+      #
+      attr_accessor :timeout
+
+      #
+      # How long, in seconds, to wait for any one answer.  Defaults to 3.
+      #
+      attr_accessor :query_timeout
+
+      #
+      # How many names to look up at once.  Defaults to 8.
+      #
+      attr_accessor :threads
+
+      #
+      # The shortest and longest times answers are cached for, in seconds,
+      # whatever their TTL.  Default to 60 and 86400.
+      #
+      attr_accessor :min_ttl, :max_ttl
+
+      #
+      # The nameservers to use, as an array of [address, port] pairs.  If
+      # nil, the system resolver configuration is used.
+      #
+      attr_accessor :nameservers
+
+      attr_reader :filename
+
+      #
+      # For testing.
+      attr_reader :dbh
+
+      #
+      # If a database is given, answers are saved there between runs.
+      #
+      def initialize(database = nil)
+        @filename      = database
+        @timeout       = 10
+        @query_timeout = 3
+        @threads       = 8
+        @min_ttl       = 60
+        @max_ttl       = 86400
+        @nameservers   = nil
+        @cache         = Hash.new
+        @dbh           = nil
+
+        unless database.nil?
+          @dbh = SQLite3::Database.new(database)
+          @tbl_name = "resolver"
+          create_table
+          load_cache
+        end
+      end
+
+      #
+      # Resolves an array of names, and returns a hash of arrays of
+      # addresses, keyed on name.  Names with fresh answers in the cache are
+      # not looked up again.
+      #
+      def resolve(names, now = Time.now)
+        names = names.uniq
+
+        stale = names.reject do |name|
+          @cache.has_key?(name) and @cache[name][1] > now.to_i
+        end
+
+        unless stale.empty?
+          answers = do_resolve(stale)
+
+          answers.each do |name, (addresses, ttl)|
+            ttl = [[ttl, @min_ttl].max, @max_ttl].min
+            @cache[name] = [addresses, now.to_i + ttl]
+          end
+
+          (stale - answers.keys).each do |name|
+            if @cache.has_key?(name)
+              warn "#{name} could not be resolved -- using the previous answer." if $VERBOSE
+            else
+              warn "#{name} could not be resolved." if $VERBOSE
+            end
+          end
+
+          save_cache(answers.keys)
+        end
+
+        results = Hash.new
+
+        names.each do |name|
+          results[name] = (@cache.has_key?(name) ? @cache[name][0] : []).collect do |address|
+            Symbiosis::IPAddr.new(address)
+          end
+        end
+
+        results
+      end
+
+      #
+      # Resolves a single name, and returns an array of addresses.
+      #
+      def lookup(name, now = Time.now)
+        resolve([name], now)[name]
+      end
+
+      private
+
+      #
+      # Looks up the names using a pool of threads.  Returns a hash of
+      # [addresses, ttl] keyed on name, for the names that got an answer
+      # before the time ran out.
+      #
+      def do_resolve(names)
+        deadline = Time.now + @timeout
+        queue    = names.dup
+        answers  = Hash.new
+        mutex    = Mutex.new
+
+        workers = (1..[@threads, names.length].min).collect do
+          Thread.new do
+            dns = new_dns
+
+            begin
+              loop do
+                name = mutex.synchronize { queue.shift }
+                break if name.nil?
+
+                remaining = deadline - Time.now
+                break if remaining <= 0
+
+                dns.timeouts = [@query_timeout, remaining].min
+                answer = do_query(dns, name)
+
+                mutex.synchronize { answers[name] = answer } unless answer.nil?
+              end
+            ensure
+              dns.close
+            end
+          end
+        end
+
+        workers.each do |worker|
+          remaining = deadline - Time.now
+          worker.kill unless worker.join([remaining, 0].max + 1)
+        end
+
+        mutex.synchronize { answers.dup }
+      end
+
+      #
+      # Looks up the A and AAAA records for a name.  Returns [addresses, ttl],
+      # or nil if the nameservers didn't answer.  A name with no records gets
+      # an empty list of addresses.
+      #
+      def do_query(dns, name)
+        addresses = []
+        ttls = []
+
+        %w(A AAAA).each do |type|
+          #
+          # This works with CNAME records too, depending on what the
+          # resolver gives us.
+          #
+          dns.each_resource(name, Resolv::DNS::Resource::IN.const_get(type)) do |rr|
+            begin
+              addresses << Symbiosis::IPAddr.new(rr.address.to_s).to_s
+              ttls << rr.ttl
+            rescue ArgumentError
+              warn "#{type} record for #{name} returned duff IP #{rr.address.to_s.inspect}." if $VERBOSE
+            end
+          end
+        end
+
+        [addresses.uniq, (ttls.min || @min_ttl)]
+
+      rescue Resolv::ResolvError, SystemCallError, IOError => err
+        warn "#{name} could not be resolved because #{err.message}." if $VERBOSE
+        nil
+      end
+
+      def new_dns
+        config = { :raise_timeout_errors => true }
+        config[:nameserver_port] = @nameservers unless @nameservers.nil?
+
+        Resolv::DNS.new(config)
+      end
+
+      #
+      # Creates the SQLite table.
+      #
+      def create_table
+        @dbh.execute("CREATE TABLE IF NOT EXISTS #{@tbl_name}
+              (
+                name       TEXT NOT NULL PRIMARY KEY,
+                addresses  TEXT NOT NULL,
+                expires    INTEGER NOT NULL
+              )")
+      end
+
+      def load_cache
+        @dbh.execute("SELECT name, addresses, expires FROM #{@tbl_name}").each do |name, addresses, expires|
+          @cache[name] = [addresses.to_s.split(" "), expires.to_i]
+        end
+      end
+
+      def save_cache(names)
+        return if @dbh.nil? or names.empty?
+
+        @dbh.transaction do
+          names.each do |name|
+            addresses, expires = @cache[name]
+
+            @dbh.execute("INSERT OR REPLACE INTO #{@tbl_name}
+              VALUES (?, ?, ?)", [name, addresses.join(" "), expires])
+          end
+        end
+      end
+
+    end
+
+  end
+
+end
@@ -0,0 +1,103 @@
+module Symbiosis
+  module Firewall
+    #
+    # Counts events per key over a sliding window of time.  Events are
+    # gathered into buckets, so memory use depends on the number of keys and
+    # the length of the window, not on the number of events.
+    #
+    class SlidingWindow
+
+      #
+      # The length of the window, in seconds.
+      #
+      attr_reader :window
+
+      #
+      # The size of each bucket, in seconds.
+      #
+      attr_reader :bucket_size
+
+      def initialize(window, bucket_size = 60)
+        raise ArgumentError, "#{window.inspect} must be a positive integer" unless window.is_a?(Integer) and window > 0
+        raise ArgumentError, "#{bucket_size.inspect} must be a positive integer" unless bucket_size.is_a?(Integer) and bucket_size > 0
+
+        @window      = window
+        @bucket_size = bucket_size
+        @buckets     = Hash.new
+        @totals      = Hash.new(0)
+      end
+
+      #
+      # Adds n events for key at time now, and returns the number of events
+      # for key in the window.
+      #
+      def add(key, n = 1, now = Time.now)
+        bucket  = now.to_i / @bucket_size
+        buckets = @buckets[key]
+
+        prune(key, buckets, bucket) unless buckets.nil?
+        buckets = (@buckets[key] ||= [])
+
+        if buckets.last and buckets.last[0] == bucket
+          buckets.last[1] += n
+        else
+          buckets << [bucket, n]
+        end
+
+        @totals[key] += n
+      end
+
+      #
+      # Returns the number of events for key in the window at time now.
+      #
+      def count(key, now = Time.now)
+        buckets = @buckets[key]
+        return 0 if buckets.nil?
+
+        prune(key, buckets, now.to_i / @bucket_size)
+        @totals.fetch(key, 0)
+      end
+
+      #
+      # Forgets about every key that has had no events in the window.
+      # Returns the keys removed.
+      #
+      def expire(now = Time.now)
+        bucket = now.to_i / @bucket_size
+        expired = []
+
+        @buckets.keys.each do |key|
+          prune(key, @buckets[key], bucket)
+          expired << key unless @buckets.has_key?(key)
+        end
+
+        expired
+      end
+
+      #
+      # Returns the number of keys being counted.
+      #
+      def size
+        @buckets.size
+      end
+
+      private
+
+      def prune(key, buckets, bucket)
+        oldest = bucket - (@window / @bucket_size)
+
+        while buckets.first and buckets.first[0] <= oldest
+          @totals[key] -= buckets.shift[1]
+        end
+
+        if buckets.empty?
+          @buckets.delete(key)
+          @totals.delete(key)
+        end
+      end
+
+    end
+
+  end
+
+end
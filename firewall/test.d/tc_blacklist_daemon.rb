@@ -0,0 +1,86 @@
+$: << "../lib/"
+require 'symbiosis/firewall/blacklist_daemon'
+require 'test/unit'
+require 'tmpdir'
+require 'fileutils'
+
+class TestBlacklistDaemon < Test::Unit::TestCase
+
+  include Symbiosis::Firewall
+
+  def setup
+    @prefix = Dir.mktmpdir("blacklist-daemon-")
+    @log = File.join(@prefix, "auth.log")
+
+    Dir.mkdir(File.join(@prefix, "patterns.d"))
+    Dir.mkdir(File.join(@prefix, "blacklist.d"))
+
+    #
+    # Symbiosis::Utils.set_param won't write to directories owned by system
+    # users.
+    #
+    File.chown(1000, 1000, File.join(@prefix, "blacklist.d")) if Process.uid == 0
+
+    File.open(File.join(@prefix, "patterns.d", "openssh.patterns"), "w") do |fh|
+      fh.puts "file = #{@log}"
+      fh.puts "ports = 22"
+      fh.puts "Failed password for \\S+ from __IP__ port \\d+ ssh2"
+    end
+
+    FileUtils.touch(@log)
+
+    @daemon = BlacklistDaemon.new(@prefix)
+    @daemon.logtail_db = File.join(@prefix, "logtail.db")
+    @daemon.block_after = 3
+    @daemon.block_all_after = 5
+  end
+
+  def teardown
+    FileUtils.rm_rf(@prefix)
+  end
+
+  def fail_from(ip, n)
+    File.open(@log, "a") do |fh|
+      n.times { fh.puts "Dec  5 03:42:19 example sshd[1]: Failed password for root from #{ip} port 1234 ssh2" }
+    end
+  end
+
+  def test_blocks_port_then_all
+    now = Time.now
+
+    fail_from("8.8.8.8", 3)
+    assert_equal({}, @daemon.check(now))
+
+    fail_from("8.8.8.8", 1)
+    assert_equal({"8.8.8.8" => %w(22)}, @daemon.check(now))
+    assert_equal("22", File.read(File.join(@prefix, "blacklist.d", "8.8.8.8.auto")))
+
+    #
+    # Nothing changes until the all-ports limit is reached.
+    #
+    fail_from("8.8.8.8", 1)
+    assert_equal({}, @daemon.check(now))
+
+    fail_from("8.8.8.8", 1)
+    assert_equal({"8.8.8.8" => %w(all)}, @daemon.check(now))
+    assert_equal("all", File.read(File.join(@prefix, "blacklist.d", "8.8.8.8.auto")))
+  end
+
+  def test_window_slides
+    now = Time.now
+
+    fail_from("8.8.4.4", 3)
+    assert_equal({}, @daemon.check(now))
+
+    fail_from("8.8.4.4", 1)
+    assert_equal({}, @daemon.check(now + @daemon.port_window + 60))
+    assert(!File.exist?(File.join(@prefix, "blacklist.d", "8.8.4.4.auto")))
+  end
+
+  def test_localhost_ignored
+    fail_from("127.0.0.1", 10)
+    @daemon.check
+    assert(!File.exist?(File.join(@prefix, "blacklist.d", "127.0.0.1.auto")))
+  end
+
+end
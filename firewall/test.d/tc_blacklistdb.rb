@@ -47,6 +47,55 @@ class TestBlacklistDb < Test::Unit::TestCase
     assert_equal(5, @db.get_count_for(ip, timestamp - 5))
   end
 
+
+  def test_set_counts
+    timestamp = Time.now.to_i
+    @db.set_counts({"1.2.3.4" => 3, "1.2.3.5" => 4}, timestamp)
+    @db.set_counts({"1.2.3.4" => 2}, timestamp)
+
+    assert_equal({"1.2.3.4" => 5, "1.2.3.5" => 4, "1.2.3.6" => 0},
+                 @db.get_counts(%w(1.2.3.4 1.2.3.5 1.2.3.6), timestamp - 60))
+  end
+
+  def test_window
+    timestamp = Time.now.to_i
+    @db.set_count_for("1.2.3.4", 7, timestamp - 30*3600)
+    @db.set_count_for("1.2.3.4", 5, timestamp)
+
+    assert_equal(5, @db.get_count_for("1.2.3.4", timestamp - 24*3600))
+    assert_equal(12, @db.get_count_for("1.2.3.4", timestamp - 48*3600))
+  end
+
+  def test_expiry
+    #
+    # A week of runs every quarter of an hour should never leave more than
+    # the last 48 hours' worth of buckets behind.
+    #
+    timestamp = Time.now.to_i - 7*86400
+
+    (7*24*4).times do
+      @db.set_counts({"1.2.3.4" => 1, "2001:db8::/64" => 2}, timestamp += 900)
+    end
+
+    assert(@db.dbh.execute("SELECT COUNT(*) FROM blacklist_hourly").flatten.first <= 2*49)
+
+    #
+    # The window starts at the beginning of the hour it falls in.
+    #
+    cnt = @db.get_count_for("1.2.3.4", timestamp - 86400 + 1)
+    assert(cnt >= 24*4 && cnt <= 25*4, cnt.to_s)
+  end
+
+  def test_old_table
+    timestamp = Time.now.to_i
+    @db.dbh.execute("CREATE TABLE blacklist (ip TEXT NOT NULL, timestamp INTEGER NOT NULL, count INTEGER NOT NULL)")
+    @db.dbh.execute("INSERT INTO blacklist VALUES ('1.2.3.4', ?, 3)", [timestamp - 10])
+    @db.dbh.execute("INSERT INTO blacklist VALUES ('1.2.3.4', ?, 3)", [timestamp - 100*3600])
+
+    db = BlacklistDB.new(@fn.path)
+    assert_equal(3, db.get_count_for("1.2.3.4", timestamp - 86400))
+    assert(db.dbh.execute("SELECT name FROM sqlite_master WHERE name = 'blacklist'").empty?)
+  end
   
 end
 
@@ -0,0 +1,67 @@
+$: << "../lib/"
+require 'symbiosis/firewall/cidr_aggregator'
+require 'test/unit'
+
+class TestCIDRAggregator < Test::Unit::TestCase
+
+  include Symbiosis::Firewall
+
+  def do_aggregate(agg, addresses)
+    addresses.each { |address| agg.add(address) }
+    agg.aggregate.collect{|ip| ip.to_s}
+  end
+
+  def test_exact
+    agg = CIDRAggregator.new
+
+    addresses = %w(192.0.2.0/25 192.0.2.128/26 192.0.2.192/26 192.0.2.7
+                   198.51.100.1 198.51.100.3 2001:db8::/65 2001:db8::8000:0:0:0/65
+                   2001:db8:0:1::/64 10.0.0.0/8 10.1.2.3)
+
+    expected = %w(10.0.0.0/8 192.0.2.0/24 198.51.100.1 198.51.100.3 2001:db8::/63)
+
+    assert_equal(expected, do_aggregate(agg, addresses))
+  end
+
+  def test_add
+    agg = CIDRAggregator.new
+
+    assert(agg.add("192.0.2.0/24"))
+    assert(!agg.add("192.0.2.1"))
+    assert(!agg.add("192.0.2.0/24"))
+    assert(agg.add("192.0.3.1"))
+  end
+
+  def test_collapse
+    agg = CIDRAggregator.new("inet" => {24 => 3}, "inet6" => {48 => 2})
+
+    addresses = %w(192.0.2.1 192.0.2.99 192.0.2.200 198.51.100.1 198.51.100.2
+                   2001:db8:1:1::/64 2001:db8:1:2::/64 2001:db8:2::/64)
+
+    expected = %w(192.0.2.0/24 198.51.100.1 198.51.100.2 2001:db8:1::/48 2001:db8:2::/64)
+
+    assert_equal(expected, do_aggregate(agg, addresses))
+
+    #
+    # Adding the same address twice shouldn't count twice.
+    #
+    agg = CIDRAggregator.new("inet" => {24 => 3})
+    assert_equal(%w(192.0.2.1 192.0.2.2), do_aggregate(agg, %w(192.0.2.1 192.0.2.1 192.0.2.2)))
+
+    #
+    # A range added after addresses inside it replaces them, so they
+    # shouldn't count towards a larger range as well.
+    #
+    agg = CIDRAggregator.new("inet" => {16 => 3})
+    assert_equal(%w(192.0.2.0/24 192.0.3.1), do_aggregate(agg, %w(192.0.2.1 192.0.2.2 192.0.2.0/24 192.0.3.1)))
+  end
+
+  def test_parse_policy
+    policy = CIDRAggregator.parse_policy("# Collapse busy ranges\ninet 24 4\n\ninet6 /48 8 # providers\n")
+    assert_equal({"inet" => {24 => 4}, "inet6" => {48 => 8}}, policy)
+
+    assert_raise(ArgumentError) { CIDRAggregator.new("inet" => {33 => 4}) }
+    assert_raise(ArgumentError) { CIDRAggregator.new("inet" => {24 => 0}) }
+  end
+
+end
@@ -84,7 +84,152 @@ class TestFirewallIPDirectory < Test::Unit::TestCase
       end
     end
   end
-  
-end
 
+  def test_ipset
+    file_contents = {
+      "1.2.3.1" => "all",
+      "1.2.3.5" => "465",
+      "1.2.3.7" => "465\n587",
+      "2001:41c8::1" => nil,
+      "2001:41c8:1::1|29" => nil
+    }
+
+    file_contents.each do |fn, contents|
+      File.open(File.join(@prefix, fn), "w+") do |fh|
+        fh.puts contents unless contents.nil?
+      end
+    end
+
+    Template.directories = ["rule.d"]
+    Template.address_families = %w(inet inet6)
+    list = IPListDirectory.new(@prefix,"incoming","blacklist" )
+    list.target = "DROP"
+
+    expected = [
+      "create blacklist-4-all hash:net family inet -exist",
+      "create blacklist-4-all-new hash:net family inet -exist",
+      "flush blacklist-4-all-new",
+      "add blacklist-4-all-new 1.2.3.1 -exist",
+      "swap blacklist-4-all-new blacklist-4-all",
+      "destroy blacklist-4-all-new",
+      "create blacklist-4-465 hash:net family inet -exist",
+      "create blacklist-4-465-new hash:net family inet -exist",
+      "flush blacklist-4-465-new",
+      "add blacklist-4-465-new 1.2.3.5 -exist",
+      "add blacklist-4-465-new 1.2.3.7 -exist",
+      "swap blacklist-4-465-new blacklist-4-465",
+      "destroy blacklist-4-465-new",
+      "create blacklist-4-587 hash:net family inet -exist",
+      "create blacklist-4-587-new hash:net family inet -exist",
+      "flush blacklist-4-587-new",
+      "add blacklist-4-587-new 1.2.3.7 -exist",
+      "swap blacklist-4-587-new blacklist-4-587",
+      "destroy blacklist-4-587-new",
+      "create blacklist-6-all hash:net family inet6 -exist",
+      "create blacklist-6-all-new hash:net family inet6 -exist",
+      "flush blacklist-6-all-new",
+      "add blacklist-6-all-new 2001:41c8::/29 -exist",
+      "swap blacklist-6-all-new blacklist-6-all",
+      "destroy blacklist-6-all-new"
+    ]
+
+    assert_equal(expected, list.ipset_restore.split("\n"))
+
+    expected = [
+      "*filter",
+      ":blacklist - [0:0]",
+      "-A blacklist -m set --match-set blacklist-4-all src -j DROP",
+      "-A blacklist -p tcp --dport 465 -m set --match-set blacklist-4-465 src -j DROP",
+      "-A blacklist -p udp --dport 465 -m set --match-set blacklist-4-465 src -j DROP",
+      "-A blacklist -p tcp --dport 587 -m set --match-set blacklist-4-587 src -j DROP",
+      "-A blacklist -p udp --dport 587 -m set --match-set blacklist-4-587 src -j DROP",
+      "COMMIT"
+    ]
+
+    assert_equal(expected, list.iptables_restore("inet").split("\n"))
+
+    list.target = "ACCEPT"
+    expected = [
+      "*filter",
+      ":blacklist - [0:0]",
+      "-A blacklist -m set --match-set blacklist-6-all src -j ACCEPT",
+      "COMMIT"
+    ]
+
+    assert_equal(expected, list.iptables_restore("inet6").split("\n"))
+
+    assert_raise(ArgumentError) { list.target = "DROP; rm -rf /" }
+  end
 
+  def test_ipset_delta
+    file_contents = {
+      "1.2.3.1" => "all",
+      "1.2.3.2" => "all",
+      "1.2.3.5" => "465",
+      "2001:41c8::1" => nil
+    }
+
+    file_contents.each do |fn, contents|
+      File.open(File.join(@prefix, fn), "w+") do |fh|
+        fh.puts contents unless contents.nil?
+      end
+    end
+
+    Template.directories = ["rule.d"]
+    Template.address_families = %w(inet inet6)
+    list = IPListDirectory.new(@prefix,"incoming","blacklist" )
+
+    saved = [
+      "create blacklist-4-all hash:net family inet hashsize 1024 maxelem 65536",
+      "add blacklist-4-all 1.2.3.1",
+      "add blacklist-4-all 1.2.3.3",
+      "create blacklist-4-22 hash:net family inet hashsize 1024 maxelem 65536",
+      "add blacklist-4-22 1.2.3.4",
+      "create blacklist-6-all hash:net family inet6 hashsize 1024 maxelem 65536",
+      "add blacklist-6-all 2001:41c8:0:0::1",
+      "create whitelist-4-all hash:net family inet hashsize 1024 maxelem 65536",
+      "add whitelist-4-all 1.2.3.2"
+    ].join("\n")
+
+    current = list.parse_ipset_save(saved)
+
+    expected = {
+      "blacklist-4-all" => %w(1.2.3.1 1.2.3.3),
+      "blacklist-4-22" => %w(1.2.3.4),
+      "blacklist-6-all" => %w(2001:41c8::1)
+    }
+    assert_equal(expected, current)
+
+    #
+    # Only the changes should be applied to sets that already exist.
+    #
+    expected = [
+      "del blacklist-4-all 1.2.3.3 -exist",
+      "add blacklist-4-all 1.2.3.2 -exist",
+      "create blacklist-4-465 hash:net family inet -exist",
+      "create blacklist-4-465-new hash:net family inet -exist",
+      "flush blacklist-4-465-new",
+      "add blacklist-4-465-new 1.2.3.5 -exist",
+      "swap blacklist-4-465-new blacklist-4-465",
+      "destroy blacklist-4-465-new"
+    ]
+
+    assert_equal(expected, list.ipset_restore(list.ipsets, current).split("\n"))
+    assert_equal(%w(blacklist-4-22), list.obsolete_ipsets(list.ipsets, current))
+
+    #
+    # The set for port 22 should be destroyed after the rules referring to it
+    # have gone.
+    #
+    script = list.to_ipset_s(%w(/sbin/iptables /sbin/ip6tables), current)
+    assert_match(/ip6tables-restore --noflush <<'EOF'.*EOF\n\/sbin\/ipset restore <<'EOF'\ndestroy blacklist-4-22\nEOF\z/m, script)
+
+    #
+    # Nothing to do if nothing has changed.
+    #
+    current = list.parse_ipset_save(list.ipset_restore.gsub("-new",""))
+    assert_equal("", list.ipset_restore(list.ipsets, current))
+    assert_equal([], list.obsolete_ipsets(list.ipsets, current))
+  end
+
+end
@@ -9,35 +9,80 @@ class TestLogtail < Test::Unit::TestCase
 
   def setup
     @db = "test_logtail.db"
+    @fn = "log/messages"
+    @src = "log/syslog"
   end
 
   def teardown
    File.unlink(@db) if File.exist?(@db)
+   File.unlink(@fn) if File.exist?(@fn)
+   File.unlink(@fn+".1") if File.exist?(@fn+".1")
   end
 
   def test_me
-    fn = "log/syslog"
+    #
+    # Each of these files has the previous one as its start, so rewriting the
+    # log in place looks like it growing.
+    #
     (1..5).each do |f|
-      File.symlink("#{File.basename(fn)}.#{f}",fn)
-      lt = Logtail.new("log/syslog",@db)
+      File.open(@fn, "w") { |fh| fh.write(File.read("#{@src}.#{f}")) }
+      lt = Logtail.new(@fn, @db)
       assert_equal(10, lt.readlines.length, f)
-      File.unlink(fn)
     end
-    
+
+    #
+    # Rotate the log, and start again.
+    #
+    File.rename(@fn, @fn+".1")
+
     (6..10).each do |f|
-      File.symlink("#{File.basename(fn)}.#{f}",fn)
-      lt = Logtail.new("log/syslog",@db)
+      File.open(@fn, "w") { |fh| fh.write(File.read("#{@src}.#{f}")) }
+      lt = Logtail.new(@fn, @db)
       assert_equal(10, lt.readlines.length, f)
-      File.unlink(fn)
     end
+  end
 
-  ensure
-    File.unlink(fn) if File.exist?(fn)
+  def test_rotated_remainder
+    File.open(@fn, "w") { |fh| fh.write(File.read("#{@src}.1")) }
+    assert_equal(10, Logtail.new(@fn, @db).readlines.length)
+
+    #
+    # More lines get written, and then the log is rotated before we read them.
+    #
+    File.open(@fn, "w") { |fh| fh.write(File.read("#{@src}.3")) }
+    File.rename(@fn, @fn+".1")
+    File.open(@fn, "w") { |fh| fh.write(File.read("#{@src}.6")) }
+
+    lines = Logtail.new(@fn, @db).readlines
+    assert_equal(30, lines.length)
+    assert_equal(File.readlines("#{@src}.3")[10], lines.first)
+    assert_equal(File.readlines("#{@src}.6").last, lines.last)
   end
-  
-end
 
+  def test_truncated
+    File.open(@fn, "w") { |fh| fh.write(File.read("#{@src}.5")) }
+    assert_equal(50, Logtail.new(@fn, @db).readlines.length)
 
+    File.open(@fn, "w") { |fh| fh.write(File.read("#{@src}.6")) }
+    assert_equal(10, Logtail.new(@fn, @db).readlines.length)
+  end
+
+  def test_each_batch
+    File.open(@fn, "w") { |fh| fh.write(File.read("#{@src}.5")) }
+
+    batches = []
+    Logtail.new(@fn, @db).each_batch(20) { |lines| batches << lines.length }
+    assert_equal([20, 20, 10], batches)
+  end
 
+  def test_partial_and_invalid_lines
+    File.open(@fn, "w") { |fh| fh.write("one \xff\n", "tw") }
+    assert_equal(["one \n"], Logtail.new(@fn, @db).readlines)
 
+    File.open(@fn, "a") { |fh| fh.write("o\nthree\n") }
+    lines = Logtail.new(@fn, @db).readlines
+    assert_equal(["two\n", "three\n"], lines)
+    assert(lines.all?{|l| l.encoding == Encoding::UTF_8})
+  end
 
+end
@@ -1,4 +1,5 @@
 $: << "../lib/"
+$: << "../ext/symbiosis_pattern_matcher/"
 require 'symbiosis/firewall/pattern'
 require 'test/unit'
 require 'pp'
@@ -21,8 +22,97 @@ class TestPattern < Test::Unit::TestCase
   def test_apply
     lines = File.readlines 'log/auth.log'
     patt = Pattern.new("pattern.d/openssh.patterns")
-    pp patt.apply(lines) if $VERBOSE
+    results = patt.apply(lines)
+    pp results if $VERBOSE
 
+    assert_equal({"22" => 11}, results["10.18.152.10"])
+    assert_equal({"22" => 1}, results["2001:1af:ba8:123::/64"])
+  end
+
+  def test_native_matcher_agrees_with_ruby
+    unless PatternMatcher.instance_method(:count).owner != RubyPatternMatcher
+      puts "Not running TestPattern::test_native_matcher_agrees_with_ruby because symbiosis_pattern_matcher not loaded."
+      return
+    end
+
+    lines = File.readlines('log/auth.log') + File.readlines('log/syslog.complete')
+    native = PatternMatcher.new
+    ruby   = RubyPatternMatcher.new
+
+    patterns = Pattern.new("pattern.d/openssh.patterns").patterns + [
+      /Accepted \S+ for \S+ from (?:::ffff:)?([0-9a-fA-F:\.]+) port/,
+      /(\d+\.\d+\.\d+\.\d+)/,
+      /(?i)FAILED PASSWORD.* from (\S+)/,
+      /CRON|(sshd)/,
+      /no capture here/,
+    ]
+
+    patterns.each_with_index do |pattern, i|
+      native.add(pattern, i % 3)
+      ruby.add(pattern, i % 3)
+    end
+
+    assert_equal(ruby.count(lines), native.count(lines))
+  end
+
+  def test_native_matcher_literals
+    unless PatternMatcher.method_defined?(:literals)
+      puts "Not running TestPattern::test_native_matcher_literals because symbiosis_pattern_matcher not loaded."
+      return
+    end
+
+    matcher = PatternMatcher.new
+    [
+      /Failed \S+ for .* from (\S+) port \d+ ssh2$/,
+      /\[(\S+)\] rejected AUTH LOGIN/,
+      /abcde?f+ghi (\S+)/,
+      /x{2,3}abcdef (\S+)/,
+      /foo|bar (\S+)/,
+      /(?i)rejected (\S+)/,
+      /rejected (\S+)/i,
+    ].each { |r| matcher.add(r, nil) }
+
+    assert_equal(["Failed ", "] rejected AUTH LOGIN", "abcd", "abcdef ", nil, nil, nil], matcher.literals)
+  end
+
+  def test_native_matcher_escapes
+    unless PatternMatcher.method_defined?(:literals)
+      puts "Not running TestPattern::test_native_matcher_escapes because symbiosis_pattern_matcher not loaded."
+      return
+    end
+
+    patterns = [
+      /\x41bcdef (\S+)/,
+      /\u{41}bcdeg (\S+)/,
+      /ab\101cdefg (\S+)/,
+      /\u0041xyzzy (\S+)/,
+      /\cAplugh (\S+)/,
+      /\C-Aquux (\S+)/,
+    ]
+
+    matcher = PatternMatcher.new
+    patterns.each { |r| matcher.add(r, nil) }
+
+    #
+    # None of the escape should end up in the literal.
+    #
+    assert_equal(["bcdef ", "bcdeg ", "cdefg ", "xyzzy ", "plugh ", "quux "], matcher.literals)
+
+    lines = [
+      "Abcdef 10.0.0.1",
+      "Abcdeg 10.0.0.2",
+      "abAcdefg 10.0.0.3",
+      "Axyzzy 10.0.0.4",
+      "\x01plugh 10.0.0.5",
+      "\x01quux 10.0.0.6",
+    ]
+
+    ruby = RubyPatternMatcher.new
+    patterns.each { |r| ruby.add(r, nil) }
+
+    expected = {nil => Hash[(1..6).collect { |i| ["10.0.0.#{i}", 1] }]}
+    assert_equal(expected, ruby.count(lines))
+    assert_equal(expected, matcher.count(lines))
   end
 
 
@@ -0,0 +1,137 @@
+$: << "../lib/"
+require 'symbiosis/firewall/resolver'
+require 'symbiosis/firewall/directory'
+require 'test/unit'
+require 'tmpdir'
+require 'socket'
+
+class TestResolver < Test::Unit::TestCase
+
+  include Symbiosis::Firewall
+
+  #
+  # A very small nameserver, that answers from @records, and ignores
+  # anything it doesn't know about.
+  #
+  def setup
+    @records = {
+      "one.example.com" => {"A" => %w(192.0.2.1 192.0.2.2), "AAAA" => %w(2001:db8::1)},
+      "two.example.com" => {"A" => %w(192.0.2.3)},
+      "none.example.com" => {}
+    }
+    @queries = Hash.new(0)
+
+    @socket = UDPSocket.new
+    @socket.bind("127.0.0.1", 0)
+    @port = @socket.addr[1]
+
+    @server = Thread.new do
+      loop do
+        data, from = @socket.recvfrom(512)
+        query = Resolv::DNS::Message.decode(data)
+        name, typeclass = query.question.first
+        name = name.to_s
+        @queries[name] += 1
+
+        next unless @records.has_key?(name)
+
+        reply = Resolv::DNS::Message.new(query.id)
+        reply.qr = 1
+        reply.rd = query.rd
+        reply.ra = 1
+        reply.add_question(name, typeclass)
+
+        type = typeclass.name.split("::").last
+        (@records[name][type] || []).each do |address|
+          reply.add_answer(name, 300, typeclass.new(address))
+        end
+
+        @socket.send(reply.encode, 0, from[3], from[1])
+      end
+    end
+
+    @prefix = Dir.mktmpdir("firewall")
+    @db = File.join(@prefix, "resolver.db")
+  end
+
+  def teardown
+    @server.kill
+    @socket.close
+    FileUtils.remove_entry_secure @prefix
+  end
+
+  def new_resolver
+    resolver = Resolver.new(@db)
+    resolver.nameservers = [["127.0.0.1", @port]]
+    resolver.timeout = 2
+    resolver.query_timeout = 1
+    resolver
+  end
+
+  def test_resolve
+    resolver = new_resolver
+    results = resolver.resolve(%w(one.example.com two.example.com none.example.com slow.example.com))
+
+    assert_equal(%w(192.0.2.1 192.0.2.2 2001:db8::1), results["one.example.com"].collect{|ip| ip.to_s})
+    assert_equal(%w(192.0.2.3), results["two.example.com"].collect{|ip| ip.to_s})
+    assert_equal([], results["none.example.com"])
+    assert_equal([], results["slow.example.com"])
+
+    #
+    # Second time round, the answers should come from the cache.
+    #
+    @queries.clear
+    assert_equal(%w(192.0.2.3), resolver.lookup("two.example.com").collect{|ip| ip.to_s})
+    assert_equal(0, @queries["two.example.com"])
+  end
+
+  def test_timeout_budget
+    resolver = new_resolver
+    resolver.threads = 4
+
+    names = (1..8).collect{|i| "slow#{i}.example.com"}
+
+    start = Time.now
+    resolver.resolve(names)
+    assert(Time.now - start < 4, "Resolving took longer than the time allowed")
+  end
+
+  def test_stale_answers
+    resolver = new_resolver
+    now = Time.now
+    resolver.lookup("one.example.com", now)
+
+    #
+    # Now the nameserver has gone away, and the answer has expired.  The
+    # old answer should be used, even from a new resolver.
+    #
+    @records.delete("one.example.com")
+    resolver = new_resolver
+    @queries.clear
+    results = resolver.lookup("one.example.com", now + 3600)
+
+    assert(@queries["one.example.com"] > 0)
+    assert_equal(%w(192.0.2.1 192.0.2.2 2001:db8::1), results.collect{|ip| ip.to_s})
+  end
+
+  def test_directory
+    Directory.resolver = new_resolver
+    Template.directories = ["rule.d"]
+
+    dir = File.join(@prefix, "blacklist.d")
+    Dir.mkdir(dir)
+    FileUtils.touch(File.join(dir, "two.example.com"))
+    FileUtils.touch(File.join(dir, "192.0.2.9"))
+
+    list = IPListDirectory.new(dir, "incoming", "blacklist")
+    list.target = "DROP"
+    sets = list.ipsets
+
+    assert_equal(%w(192.0.2.3 192.0.2.9), sets[["inet", nil]].collect{|ip| ip.to_s})
+    #
+    # One query each for A and AAAA.
+    #
+    assert_equal(2, @queries["two.example.com"])
+  end
+
+end
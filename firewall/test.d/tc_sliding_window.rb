@@ -0,0 +1,45 @@
+$: << "../lib/"
+require 'symbiosis/firewall/sliding_window'
+require 'test/unit'
+
+class TestSlidingWindow < Test::Unit::TestCase
+
+  include Symbiosis::Firewall
+
+  def test_add_and_count
+    sw = SlidingWindow.new(600)
+    now = Time.at(1500000000)
+
+    assert_equal(1, sw.add("1.2.3.4", 1, now))
+    assert_equal(4, sw.add("1.2.3.4", 3, now + 60))
+    assert_equal(2, sw.add("1.2.3.5", 2, now + 60))
+
+    assert_equal(4, sw.count("1.2.3.4", now + 599))
+    assert_equal(3, sw.count("1.2.3.4", now + 600))
+    assert_equal(0, sw.count("1.2.3.4", now + 660))
+    assert_equal(0, sw.count("1.2.3.6", now))
+  end
+
+  def test_expire
+    sw = SlidingWindow.new(600)
+    now = Time.at(1500000000)
+
+    sw.add("1.2.3.4", 1, now)
+    sw.add("1.2.3.5", 1, now + 300)
+    assert_equal(2, sw.size)
+
+    assert_equal(["1.2.3.4"], sw.expire(now + 600))
+    assert_equal(1, sw.size)
+
+    #
+    # Adding after expiry starts again from scratch.
+    #
+    assert_equal(1, sw.add("1.2.3.4", 1, now + 700))
+  end
+
+  def test_bad_window
+    assert_raise(ArgumentError) { SlidingWindow.new(0) }
+    assert_raise(ArgumentError) { SlidingWindow.new(60, "1") }
+  end
+
+end
@@ -1,10 +1,14 @@
 
 require 'test/unit'
 
+require 'tc_blacklist_daemon.rb'
+require 'tc_cidr_aggregator.rb'
 require 'tc_ipdirectory.rb'
 require 'tc_logtail.rb'
 require 'tc_pattern.rb'
 require 'tc_ports.rb'
+require 'tc_resolver.rb'
+require 'tc_sliding_window.rb'
 require 'tc_symbiosis_utmp.rb'
 require 'tc_templatedirectory.rb'
 require 'tc_template.rb'
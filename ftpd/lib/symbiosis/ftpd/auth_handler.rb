@@ -0,0 +1,92 @@
+require 'eventmachine'
+require 'em/protocols/line_protocol'
+require 'symbiosis/ftpd/authenticator'
+
+module Symbiosis
+  module FTPD
+    #
+    # Answers pure-ftpd's external authentication requests directly, in
+    # place of pure-authd.  pure-ftpd connects to the socket for each login,
+    # and sends
+    #
+    #   account:xxx
+    #   password:xxx
+    #   localhost:xxx
+    #   localport:xxx
+    #   peer:xxx
+    #   encrypted:xxx
+    #   end
+    #
+    # and then waits for the reply, which is the same as the output of
+    # symbiosis-ftpd-check-password.  Logins are checked in EventMachine's
+    # thread pool, so a slow password hash doesn't hold up anyone else.
+    #
+    class AuthHandler < EM::Connection
+
+      #
+      # Requests longer than this are abandoned.
+      #
+      MAX_LINES = 32
+
+      #
+      # Clients that don't finish their request within this many seconds
+      # are disconnected.
+      #
+      TIMEOUT = 30
+
+      def self.authenticator=(a)
+        @@authenticator = a
+      end
+
+      def self.authenticator
+        @@authenticator
+      end
+
+      include EventMachine::Protocols::LineProtocol
+
+      def post_init
+        @request = Hash.new
+        @lines   = 0
+        @done    = false
+        self.comm_inactivity_timeout = TIMEOUT
+      end
+
+      def receive_line(l)
+        return if @done
+
+        @lines += 1
+
+        if l == "end"
+          @done = true
+          authenticate
+        elsif @lines > MAX_LINES
+          @done = true
+          send_data "auth_ok:0\nend\n"
+          close_connection_after_writing
+        else
+          key, value = l.split(":", 2)
+          @request[key] = value.to_s unless key.nil? or @request.has_key?(key)
+        end
+      end
+
+      def authenticator
+        @@authenticator
+      end
+
+      private
+
+      def authenticate
+        account  = @request["account"]
+        password = @request["password"]
+        ip       = @request["peer"]
+
+        EM.defer(proc { authenticator.authenticate(account, password, ip).last },
+                 proc { |reply|
+                   send_data reply
+                   close_connection_after_writing
+                 })
+      end
+
+    end
+  end
+end
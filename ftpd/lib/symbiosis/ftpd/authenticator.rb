@@ -0,0 +1,127 @@
+require 'symbiosis/ftpd/user_cache'
+
+module Symbiosis
+  module FTPD
+    #
+    # Checks FTP logins, and works out the reply for pure-ftpd's external
+    # authentication interface.  See
+    # http://download.pureftpd.org/pub/pure-ftpd/doc/README.Authentication-Modules
+    #
+    # This is used both by symbiosis-ftpd-check-password, once per login,
+    # and by symbiosis-ftpd-authd, which keeps the same authenticator for
+    # every login so that the users are cached.
+    #
+    class Authenticator
+
+      #
+      # Exit codes for symbiosis-ftpd-check-password.
+      #
+      TEMPORARY_ERROR = 111
+      PERMANENT_ERROR = 1
+      SUCCESS         = 0
+
+      #
+      # How often to log the cache hit rate, in logins.
+      #
+      STATS_EVERY = 1000
+
+      attr_reader :cache, :syslog
+
+      def initialize(prefix = "/srv", syslog = nil)
+        @cache   = UserCache.new(prefix)
+        @syslog  = syslog
+        @service = "ftp"
+      end
+
+      #
+      # Checks the password for username, and returns the exit code and the
+      # reply to send back to pure-ftpd.  ip is only used for logging.
+      #
+      def authenticate(username, password, ip = "unknown")
+        ip = "unknown" if ip.nil? or ip.empty?
+
+        #
+        # username sanity check
+        #
+        if username.nil? or username.empty?
+          log_info "No username given from #{ip} for #{@service} service"
+          log_err  "#{@service} login failure from IP: #{ip} username: nil"
+
+          return [PERMANENT_ERROR, "auth_ok:0\nend\n"]
+        end
+
+        domain, user = cache.fetch(username)
+
+        log_info cache.stats if cache.lookups % STATS_EVERY == 0
+
+        if domain.nil?
+          log_info "Non-existent domain #{username.split("@",2).last.inspect} from #{ip} for #{@service} service"
+          log_err  "#{@service} login failure from IP: #{ip} username: #{username}"
+
+          return [PERMANENT_ERROR, "auth_ok:0\nend\n"]
+        end
+
+        mode = (username.include?("@") ? :multi : :single)
+
+        if user.nil?
+          log_info "Non-existent #{mode} user #{username.inspect} for domain #{domain.name} from #{ip} for #{@service} service"
+          log_err  "#{@service} login failure from IP: #{ip} username: #{username}"
+
+          return [PERMANENT_ERROR, "auth_ok:0\nend\n"]
+        end
+
+        #
+        # Try logging in.
+        #
+        unless user.login(password)
+          log_info "Bad password for username #{username} from #{ip} for #{@service} service"
+          log_err  "#{@service} login failure from IP: #{ip} username: #{username}"
+
+          return [PERMANENT_ERROR, "auth_ok:-1\nend\n"]
+        end
+
+        #
+        # Work out results before printing.
+        #
+        results = [ "uid:#{user.uid}",
+              "gid:#{user.gid}",
+              "dir:#{user.chroot_dir}" ]
+
+        results << "user_quota_size:#{user.quota}" unless user.quota.nil? or user.quota == 0
+
+        #
+        # Woo-hoo success!
+        #
+        [SUCCESS, (["auth_ok:1"]+results+["end\n"]).join("\n")]
+
+      rescue => err
+
+        #
+        # Rescue all exceptions, to make sure authentication doesn't happen
+        # automatically when things fail
+        #
+        log_err "#{err.class}: #{err.to_s} for username #{username} from #{ip} for #{@service} service"
+        log_debug err.backtrace.join("\n")
+
+        [TEMPORARY_ERROR, "auth_ok:0\nend\n"]
+      end
+
+      private
+
+      def log_info(msg)
+        syslog.info(msg.gsub("%","%%")) if syslog
+      end
+
+      def log_err(msg)
+        syslog.err(msg.gsub("%","%%")) if syslog
+      end
+
+      def log_debug(msg)
+        syslog.debug(msg.gsub("%","%%")) if syslog
+      end
+
+    end
+
+  end
+
+end
@@ -0,0 +1,177 @@
+require 'symbiosis/domains'
+require 'symbiosis/domain/ftp'
+require 'thread'
+
+module Symbiosis
+  module FTPD
+    #
+    # Caches FTP user lookups, so that a burst of logins doesn't mean
+    # finding the domain and reading its FTP password files for each one.
+    #
+    # Each entry records the files and directories the answer depended on,
+    # and is thrown away as soon as any of them changes.  Usernames that
+    # aren't found are cached too, as a brute-force attack will mostly try
+    # ones that don't exist.
+    #
+    # It is safe to use from more than one thread.
+    #
+    class UserCache
+
+      #
+      # The number of hits and misses since the cache was created.
+      #
+      attr_reader :hits, :misses
+
+      #
+      # The maximum number of entries to keep.  Defaults to 10000.
+      #
+      attr_accessor :max_entries
+
+      attr_reader :prefix
+
+      def initialize(prefix = "/srv")
+        @prefix      = prefix
+        @entries     = Hash.new
+        @hits        = 0
+        @misses      = 0
+        @max_entries = 10000
+        @mutex       = Mutex.new
+      end
+
+      #
+      # Returns the domain and FTP user for username.  Either may be nil if
+      # it wasn't found.
+      #
+      # Usernames of the form user@domain are looked up in the domain's
+      # ftp-users file, and plain domain names use its ftp-password file.
+      #
+      def fetch(username)
+        entry = @mutex.synchronize { @entries.delete(username) }
+
+        if entry and entry[:signature] == signature(entry[:files])
+          hit = true
+        else
+          hit    = false
+          domain = Symbiosis::Domains.find(domain_name(username), @prefix)
+          files  = files_for(username, domain)
+
+          #
+          # Take the signature first, so that anything that changes while
+          # the user is looked up gets noticed next time.
+          #
+          entry = { :files => files, :signature => signature(files) }
+          entry[:domain] = domain
+          entry[:user]   = user_for(username, domain)
+        end
+
+        @mutex.synchronize do
+          hit ? @hits += 1 : @misses += 1
+
+          #
+          # Keep the most recently used entries at the end.
+          #
+          @entries[username] = entry
+          @entries.shift while @entries.length > @max_entries
+        end
+
+        [entry[:domain], entry[:user]]
+      end
+
+      #
+      # Returns the total number of lookups.
+      #
+      def lookups
+        @mutex.synchronize { @hits + @misses }
+      end
+
+      #
+      # Returns the number of entries.
+      #
+      def size
+        @mutex.synchronize { @entries.size }
+      end
+
+      #
+      # Empties the cache.
+      #
+      def clear
+        @mutex.synchronize { @entries.clear }
+      end
+
+      #
+      # Returns a string summarising the hits and misses, for logging.
+      #
+      def stats
+        total = @hits + @misses
+        rate  = (total > 0 ? (100.0 * @hits / total).round : 0)
+        "FTP user cache: #{@hits} hits, #{@misses} misses (#{rate}% hit rate), #{size} entries"
+      end
+
+      private
+
+      def domain_name(username)
+        username.to_s.split("@", 2).last.to_s.downcase
+      end
+
+      def user_for(username, domain)
+        return nil if domain.nil?
+
+        if username.include?("@")
+          user = domain.ftp_multi_users.find { |u| u.username == username }
+        else
+          user = domain.ftp_single_user
+        end
+
+        #
+        # Work out the quota now, rather than in the middle of a login.
+        #
+        user.quota unless user.nil?
+
+        user
+      end
+
+      #
+      # Returns the files and directories that the lookup for username
+      # depends on.
+      #
+      def files_for(username, domain)
+        files = [@prefix, "/etc/passwd"]
+
+        if domain.nil?
+          name = domain_name(username)
+
+          [name, name.sub(/^(.*\.)?www\./,"")].uniq.each do |possible|
+            files << File.join(@prefix, possible)
+            files << File.join(@prefix, possible, "config")
+          end
+        else
+          #
+          # The domain's own directory is left out, as its mtime changes when
+          # the FTP directory is created at the first login.  Moving or
+          # removing it changes the prefix anyway.
+          #
+          files << domain.config_dir
+          files << domain.ftp_password_file
+          files << domain.ftp_users_file
+          files << File.join(domain.config_dir, "ftp-quota")
+        end
+
+        files
+      end
+
+      def signature(files)
+        files.collect do |file|
+          begin
+            stat = File.stat(file)
+            [stat.ino, stat.size, stat.mtime, stat.ctime]
+          rescue SystemCallError
+            nil
+          end
+        end
+      end
+
+    end
+
+  end
+
+end
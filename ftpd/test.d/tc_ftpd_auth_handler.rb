@@ -0,0 +1,130 @@
+require 'test/unit'
+require 'tmpdir'
+require 'socket'
+require 'timeout'
+require 'eventmachine'
+require 'symbiosis/domain'
+require 'symbiosis/ftpd/auth_handler'
+require 'fileutils'
+
+class TestFtpdAuthHandler < Test::Unit::TestCase
+
+  include Symbiosis::FTPD
+
+  #
+  # Collects messages instead of sending them to syslog.
+  #
+  class TestSyslog
+    attr_reader :messages
+
+    def initialize
+      @messages = []
+      @mutex    = Mutex.new
+    end
+
+    %w(info err debug).each do |level|
+      define_method(level) { |msg| @mutex.synchronize { @messages << msg } }
+    end
+  end
+
+  def setup
+    #
+    # Drop effective privs
+    #
+    if 0 == Process.uid
+      Process.egid = 1000
+      Process.euid = 1000
+    end
+
+    @prefix = Dir.mktmpdir("srv","/tmp")
+    @domain = Symbiosis::Domain.new(nil, @prefix)
+    @domain.create
+
+    @socket_dir = Dir.mktmpdir("authd","/tmp")
+    @socket     = File.join(@socket_dir, "pure-authd.sock")
+
+    @syslog = TestSyslog.new
+    AuthHandler.authenticator = Authenticator.new(@prefix, @syslog)
+  end
+
+  def teardown
+    @domain.destroy unless @domain.nil?
+
+    #
+    # Remove the @prefix directory
+    #
+    FileUtils.remove_entry_secure @prefix
+    FileUtils.remove_entry_secure @socket_dir
+
+    #
+    # Return back to root
+    #
+    if 0 == Process.uid
+      Process.egid = 0
+      Process.euid = 0
+    end
+  end
+
+  #
+  # Sends a request to the handler over a unix socket, the same way pure-ftpd
+  # does, and returns the reply.
+  #
+  def do_request(account, password, peer = "10.1.2.3")
+    request = ["account:#{account}",
+      "password:#{password}",
+      "localhost:192.0.2.1",
+      "localport:21",
+      "peer:#{peer}",
+      "encrypted:0",
+      "end"].join("\n") + "\n"
+
+    reply = nil
+
+    Timeout::timeout(30) do
+      EM.run do
+        EM.start_unix_domain_server(@socket, AuthHandler)
+
+        #
+        # The client blocks, so it runs in the thread pool.
+        #
+        EM.defer(proc {
+          UNIXSocket.open(@socket) do |sock|
+            sock.write(request)
+            sock.read
+          end
+        }, proc { |r|
+          reply = r
+          EM.stop
+        })
+      end
+    end
+
+    reply
+  end
+
+  def test_request
+    pw = Symbiosis::Utils.random_string
+    File.open(@domain.ftp_password_file,"w+"){|fh| fh.puts(pw)}
+
+    expected = ["auth_ok:1",
+      "uid:#{@domain.uid}",
+      "gid:#{@domain.gid}",
+      "dir:#{@domain.public_dir}/./",
+      "end\n"].join("\n")
+
+    assert_equal(expected, do_request(@domain.name, pw))
+  end
+
+  def test_bad_password
+    pw = Symbiosis::Utils.random_string
+    File.open(@domain.ftp_password_file,"w+"){|fh| fh.puts(pw)}
+
+    assert_equal("auth_ok:-1\nend\n", do_request(@domain.name, pw+"x", "10.1.2.3"))
+
+    #
+    # The peer's address should have been logged.
+    #
+    assert(@syslog.messages.any? { |msg| msg.include?("from IP: 10.1.2.3") }, "The peer's address wasn't logged")
+  end
+
+end
@@ -0,0 +1,111 @@
+require 'test/unit'
+require 'tmpdir'
+require 'symbiosis/domain'
+require 'symbiosis/ftpd/authenticator'
+require 'fileutils'
+
+class TestFtpdAuthenticator < Test::Unit::TestCase
+
+  include Symbiosis::FTPD
+
+  def setup
+    #
+    # Drop effective privs
+    #
+    if 0 == Process.uid
+      Process.egid = 1000
+      Process.euid = 1000
+    end
+
+    @prefix = Dir.mktmpdir("srv","/tmp")
+    @domain = Symbiosis::Domain.new(nil, @prefix)
+    @domain.create
+
+    @auth = Authenticator.new(@prefix)
+  end
+
+  def teardown
+    @domain.destroy unless @domain.nil?
+
+    #
+    # Remove the @prefix directory
+    #
+    FileUtils.remove_entry_secure @prefix
+
+    #
+    # Return back to root
+    #
+    if 0 == Process.uid
+      Process.egid = 0
+      Process.euid = 0
+    end
+  end
+
+  def auth_reply(dir="#{@domain.public_dir}/./", quota=nil)
+    arr = ["auth_ok:1",
+      "uid:#{@domain.uid}",
+      "gid:#{@domain.gid}",
+      "dir:#{dir}" ]
+    arr << "user_quota_size:#{quota}" if quota
+    arr << "end\n"
+    arr.join("\n")
+  end
+
+  def test_authenticate
+    pw = Symbiosis::Utils.random_string
+    File.open(@domain.ftp_password_file,"w+"){|fh| fh.puts(pw)}
+
+    assert_equal([Authenticator::SUCCESS, auth_reply], @auth.authenticate(@domain.name, pw))
+    assert_equal([Authenticator::PERMANENT_ERROR, "auth_ok:-1\nend\n"], @auth.authenticate(@domain.name, pw+"x"))
+    assert_equal([Authenticator::PERMANENT_ERROR, "auth_ok:0\nend\n"], @auth.authenticate("nonexistent."+@domain.name, pw))
+    assert_equal([Authenticator::PERMANENT_ERROR, "auth_ok:0\nend\n"], @auth.authenticate(nil, pw))
+    assert_equal([Authenticator::TEMPORARY_ERROR, "auth_ok:0\nend\n"], @auth.authenticate(@domain.name, ""))
+  end
+
+  def test_multi_user
+    user = Symbiosis::Utils.random_string
+    pw   = Symbiosis::Utils.random_string
+
+    File.open(@domain.ftp_users_file,"w+"){|fh| fh.puts("#{user}:#{pw}:#{@domain.directory}:100M")}
+
+    assert_equal([Authenticator::SUCCESS, auth_reply(@domain.directory, 100000000)], @auth.authenticate("#{user}@#{@domain.name}", pw))
+    assert_equal([Authenticator::PERMANENT_ERROR, "auth_ok:0\nend\n"], @auth.authenticate("nobody@#{@domain.name}", pw))
+  end
+
+  def test_cache
+    pw = Symbiosis::Utils.random_string
+    File.open(@domain.ftp_password_file,"w+"){|fh| fh.puts(pw)}
+
+    cache = @auth.cache
+
+    2.times { assert_equal(Authenticator::SUCCESS, @auth.authenticate(@domain.name, pw).first) }
+    assert_equal(1, cache.misses)
+    assert_equal(1, cache.hits)
+
+    #
+    # Changing the password should be noticed straight away.
+    #
+    new_pw = pw + "new"
+    File.open(@domain.ftp_password_file,"w+"){|fh| fh.puts(new_pw)}
+
+    assert_equal(Authenticator::PERMANENT_ERROR, @auth.authenticate(@domain.name, pw).first)
+    assert_equal(Authenticator::SUCCESS, @auth.authenticate(@domain.name, new_pw).first)
+    assert_equal(2, cache.misses)
+
+    #
+    # Domains that don't exist are cached too, until they are created.
+    #
+    other = "other."+@domain.name
+    2.times { assert_equal(Authenticator::PERMANENT_ERROR, @auth.authenticate(other, pw).first) }
+    assert_equal(3, cache.misses)
+
+    other_domain = Symbiosis::Domain.new(other, @prefix)
+    other_domain.create
+    File.open(other_domain.ftp_password_file,"w+"){|fh| fh.puts(pw)}
+
+    assert_equal(Authenticator::SUCCESS, @auth.authenticate(other, pw).first)
+  ensure
+    other_domain.destroy unless other_domain.nil?
+  end
+
+end
@@ -1,4 +1,5 @@
 require 'symbiosis/domain'
+require 'symbiosis/fingerprints'
 
 module Symbiosis
 
@@ -100,6 +101,26 @@ module Symbiosis
       return config
     end
 
+    #
+    # Returns a fingerprint of everything that goes into this domain's Apache
+    # configuration: the files in its config directory, whether its document
+    # roots exist, its aliases and IPs, the templates, and the current
+    # configuration and sites-enabled link.  Any extra values given (e.g. the
+    # host's IPs) are included too.
+    #
+    def apache_fingerprint(templates, apache2_dir='/etc/apache2', *extras)
+      config_file = File.join(apache2_dir, "sites-available", "#{self.name}.conf")
+
+      files  = Dir.glob(File.join(self.config_dir, "**", "*")).sort
+      files += templates
+      files << config_file
+      files << config_file.sub("sites-available", "sites-enabled")
+
+      Symbiosis::Fingerprints.digest(files,
+        [self.htdocs_dir, self.cgibin_dir].collect { |d| File.directory?(d) },
+        self.aliases, self.ips.collect { |ip| ip.to_s }, *extras)
+    end
+
   end
 
 end
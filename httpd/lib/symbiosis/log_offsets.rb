@@ -0,0 +1,131 @@
+require 'symbiosis/json_store'
+
+module Symbiosis
+
+  #
+  # Keeps track of how far through each log file has already been read, so
+  # only new lines need to be read next time.
+  #
+  # Logs are recognised by their device and inode numbers, so a log is still
+  # recognised after it has been rotated by renaming it.  Only complete lines
+  # are read, so a line that is half-written will be read in full next time.
+  #
+  class LogOffsets
+
+    include JSONStore
+
+    VERSION = 1
+
+    attr_reader :filename
+
+    def initialize(filename = nil)
+      @filename = filename
+      @entries  = Hash.new
+      @seen     = Hash.new
+      @pending  = Hash.new
+
+      load
+    end
+
+    #
+    # Returns the offset up to which a log has been read, or 0 if it hasn't
+    # been seen before.  If the log is now shorter than that, it is assumed
+    # to have been truncated, and 0 is returned.
+    #
+    # The log counts as looked at, so its offset is kept by #save even if
+    # there was nothing new to read.
+    #
+    def [](log)
+      stat   = File.stat(log)
+      k      = key(stat)
+      offset = @entries[k].to_i
+      offset = 0 if offset > stat.size
+
+      @seen[k] = offset if @entries.has_key?(k) and !@seen.has_key?(k)
+
+      offset
+    end
+
+    #
+    # Copies complete lines that have been added to the log since it was last
+    # read to io, and returns the number of bytes copied.  The new offset is
+    # only remembered once #commit is called, so nothing is lost if whatever
+    # is reading from io fails.
+    #
+    def copy_new_lines(log, io, chunk_size = 65536)
+      copied = 0
+
+      File.open(log, "rb") do |fh|
+        stat   = fh.stat
+        offset = self[log]
+        fh.seek(offset)
+
+        #
+        # Stop at the size the log was when we started, so we don't chase a
+        # log that is being written to.
+        #
+        remaining = stat.size - offset
+        partial   = ""
+
+        while remaining > 0 and (data = fh.read([chunk_size, remaining].min))
+          remaining -= data.length
+          data = partial + data
+
+          last = data.rindex("\n")
+
+          if last.nil?
+            partial = data
+            next
+          end
+
+          io.write(data[0..last])
+          copied += last + 1
+          partial = data[(last+1)..-1]
+        end
+
+        @seen[key(stat)]    = offset
+        @pending[key(stat)] = offset + copied
+      end
+
+      copied
+    end
+
+    #
+    # Remembers the offsets reached by #copy_new_lines since the last call.
+    #
+    def commit
+      @seen.update(@pending)
+      @entries.update(@pending)
+      @pending = Hash.new
+    end
+
+    #
+    # Forgets the offsets reached by #copy_new_lines since the last call to
+    # #commit, so the same lines are read again next time.
+    #
+    def discard
+      @pending = Hash.new
+    end
+
+    #
+    # Saves the offsets of the logs looked at, forgetting about the rest, as
+    # they will have gone.  Returns true if the file was written.
+    #
+    def save
+      save_json(@filename, "log offsets", "entries" => @seen)
+    end
+
+    private
+
+    def key(stat)
+      "#{stat.dev}:#{stat.ino}"
+    end
+
+    def load
+      data = load_json(@filename, "log offsets")
+      @entries = data["entries"] if data and data["entries"].is_a?(Hash)
+    end
+
+  end
+
+end
@@ -271,4 +271,34 @@ class TestSymbiosisHttpdConfigure < Test::Unit::TestCase
 
   end
 
+  def test_unchanged_sites_skipped
+    FileUtils.mkdir_p(File.join(@root, "var", "lib", "symbiosis"))
+    fingerprints_fn = File.join(@root, "var", "lib", "symbiosis", "httpd-configure.fingerprints.json")
+
+    domain = Symbiosis::Domain.new(nil, @prefix)
+    domain.create
+    FileUtils.mkdir_p(domain.htdocs_dir)
+    Symbiosis::Utils.set_param( "ip", "10.0.0.1", domain.config_dir)
+
+    domain_conf_fn = File.join(@apache2_dir, "sites-available", domain.name+".conf")
+
+    system("#{@script} --root-dir #{@root} --no-reload")
+
+    assert_equal(0, $?.exitstatus, "#{@script} exited with a non-zero status")
+    assert(File.exist?(domain_conf_fn), "File #{domain_conf_fn} missing")
+    assert(File.exist?(fingerprints_fn), "File #{fingerprints_fn} missing")
+
+    output = `#{@script} --root-dir #{@root} --no-reload --verbose`
+    assert_match(/Nothing has changed since the last run/, output)
+
+    #
+    # Changing the IP should mean the site is looked at again.
+    #
+    Symbiosis::Utils.set_param( "ip", "10.0.0.2", domain.config_dir)
+
+    output = `#{@script} --root-dir #{@root} --no-reload --verbose`
+    assert_no_match(/Nothing has changed since the last run/, output)
+    assert_match(/10\.0\.0\.2/, File.read(domain_conf_fn))
+  end
+
 end
@@ -0,0 +1,120 @@
+require 'test/unit'
+require 'tmpdir'
+require 'stringio'
+require 'symbiosis/log_offsets'
+
+class TestLogOffsets < Test::Unit::TestCase
+
+  include Symbiosis
+
+  def setup
+    @dir = Dir.mktmpdir("logs")
+    @log = File.join(@dir, "access.log")
+    @filename = File.join(@dir, ".offsets.json")
+  end
+
+  def teardown
+    FileUtils.rm_rf(@dir) if File.directory?(@dir)
+  end
+
+  def append(str)
+    File.open(@log, "a") { |fh| fh.write(str) }
+  end
+
+  def copy(offsets, chunk_size = 65536)
+    io = StringIO.new
+    offsets.copy_new_lines(@log, io, chunk_size)
+    io.string
+  end
+
+  def test_copy_new_lines
+    offsets = LogOffsets.new(@filename)
+
+    append("one\ntwo\nthr")
+    assert_equal("one\ntwo\n", copy(offsets, 3))
+
+    #
+    # Nothing should be remembered until commit is called.
+    #
+    assert_equal("one\ntwo\n", copy(offsets))
+    offsets.commit
+    assert_equal(8, offsets[@log])
+
+    append("ee\nfour\n")
+    assert_equal("three\nfour\n", copy(offsets))
+    offsets.discard
+    assert_equal("three\nfour\n", copy(offsets))
+    offsets.commit
+    assert_equal("", copy(offsets))
+
+    #
+    # Renaming the log shouldn't matter.
+    #
+    File.rename(@log, @log + ".1")
+    @log = @log + ".1"
+    append("five\n")
+    assert_equal("five\n", copy(offsets))
+
+    #
+    # If the log is truncated, start again.
+    #
+    File.open(@log, "w") { |fh| fh.write("six\n") }
+    assert_equal("six\n", copy(offsets))
+  end
+
+  def test_save_and_load
+    append("one\ntwo\n")
+
+    offsets = LogOffsets.new(@filename)
+    copy(offsets)
+    offsets.commit
+    assert(offsets.save)
+
+    offsets = LogOffsets.new(@filename)
+    assert_equal(8, offsets[@log])
+
+    #
+    # Logs that weren't looked at are forgotten.
+    #
+    offsets = LogOffsets.new(@filename)
+    assert(offsets.save)
+    assert_equal(0, LogOffsets.new(@filename)[@log])
+
+    #
+    # Rubbish in the file is ignored.
+    #
+    File.open(@filename, "w") { |fh| fh.puts "rubbish" }
+    assert_equal(0, LogOffsets.new(@filename)[@log])
+  end
+
+  #
+  # Does what symbiosis-httpd-generate-stats does for each run, returning
+  # the lines that would be given to webalizer.
+  #
+  def run_stats
+    offsets = LogOffsets.new(@filename)
+    output  = ""
+
+    unless offsets[@log] >= File.size(@log)
+      output = copy(offsets)
+      offsets.commit
+    end
+
+    offsets.save
+    output
+  end
+
+  def test_run_with_nothing_new
+    append("a\nb\n")
+    assert_equal("a\nb\n", run_stats)
+
+    #
+    # A run with nothing new in the log must still remember how far it got.
+    #
+    assert_equal("", run_stats)
+
+    append("c\n")
+    assert_equal("c\n", run_stats)
+  end
+
+end
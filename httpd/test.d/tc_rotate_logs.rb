@@ -0,0 +1,86 @@
+require 'test/unit'
+require 'tmpdir'
+require 'zlib'
+require 'rbconfig'
+require 'fileutils'
+require 'symbiosis/domain'
+require 'symbiosis/domain/http'
+
+class TestRotateLogs < Test::Unit::TestCase
+
+  def setup
+    @prefix = Dir.mktmpdir("srv")
+
+    #
+    # We don't want to use root for this test where poss.
+    #
+    File.chown(1000,1000,@prefix) if 0 == Process.uid
+
+    @domain = Symbiosis::Domain.new(nil, @prefix)
+    @domain.create
+    @domain.create_dir(@domain.log_dir)
+
+    testd = File.dirname(__FILE__)
+
+    @script = File.expand_path(File.join(testd,"..","sbin","symbiosis-httpd-rotate-logs"))
+    @script = '/usr/sbin/symbiosis-httpd-rotate-logs' unless File.exist?(@script)
+
+    ENV["RUBYLIB"] = $:.join(":")
+  end
+
+  def teardown
+    FileUtils.remove_entry_secure @prefix
+  end
+
+  def write_log(name, contents, mode = 0640, mtime = Time.now - 86400)
+    log = File.join(@domain.log_dir, name)
+    File.open(log, "w") { |fh| fh.write(contents) }
+    File.chmod(mode, log)
+    File.utime(mtime, mtime, log)
+    File.chown(@domain.uid, @domain.gid, log) if 0 == Process.uid
+    log
+  end
+
+  def rotate(*args)
+    output = IO.popen([RbConfig.ruby, @script, "--prefix", @prefix, *args], :err => [:child, :out]) { |io| io.read }
+    assert($?.success?, "#{@script} failed: #{output}")
+  end
+
+  def test_compress
+    contents = "127.0.0.1 - - [01/Jan/2020:00:00:00 +0000] \"GET / HTTP/1.1\" 200 0\n" * 100
+    mtime = Time.at(Time.now.to_i - 86400)
+    log = write_log("access.log", contents, 0604, mtime)
+
+    rotate("--compress-at", "1")
+
+    gz = log + ".1.gz"
+
+    assert(!File.exist?(log), "Log wasn't moved")
+    assert(!File.exist?(log + ".1"), "Uncompressed log wasn't removed")
+    assert(File.exist?(gz), "Compressed log missing")
+
+    stat = File.stat(gz)
+    assert_equal(0604, stat.mode & 0777)
+    assert_equal(mtime, stat.mtime)
+
+    Zlib::GzipReader.open(gz) do |fh|
+      assert_equal(contents, fh.read)
+      assert_equal("access.log.1", fh.orig_name)
+    end
+
+    #
+    # The temporary file should have gone.
+    #
+    assert_equal(["access.log.1.gz"], Dir.children(@domain.log_dir))
+  end
+
+  def test_no_compression
+    log = write_log("error.log", "oops\n")
+
+    rotate("--compress-at", "1", "--compress-with", "none")
+
+    assert_equal(["error.log.1"], Dir.children(@domain.log_dir))
+    assert_equal("oops\n", File.read(log + ".1"))
+  end
+
+end
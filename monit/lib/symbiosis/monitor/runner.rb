@@ -2,6 +2,7 @@ require 'log4r'
 require 'socket'
 require 'erb'
 require 'time'
+require 'thread'
 require 'symbiosis/monitor/state_db'
 require 'symbiosis/monitor/test'
 require 'symbiosis/monitor/check'
@@ -15,12 +16,25 @@ module Symbiosis
       attr_reader   :start_time, :finish_time, :template_dir
       attr_accessor :send_mail
 
+      #
+      # The number of tests to run at once.  Defaults to 4.
+      #
+      attr_accessor :concurrency
+
+      #
+      # How many seconds each test is allowed to run for before it is killed,
+      # or nil for no limit.  Defaults to 300.
+      #
+      attr_accessor :timeout
+
       def initialize(dir = "/etc/symbiosis/monit.d", state_db_fn = "/var/lib/symbiosis/monit.db", template_dir = "/usr/share/symbiosis/monitor/" )
         @dir          = dir
         raise "Test directory #{dir} not found" unless File.directory?(dir)
         @state_db_fn  = state_db_fn
         @template_dir = template_dir
         raise "Template directory #{template_dir} not found" unless File.directory?(template_dir)
+        @concurrency  = 4
+        @timeout      = 300
         self.reset
       end
 
@@ -57,51 +71,55 @@ module Symbiosis
         Socket.gethostname
       end
 
+      #
+      # Runs all the tests, up to #concurrency at once.  The results are
+      # written to the state database in one go once they've all finished,
+      # along with how long it all took.
+      #
       def go
         @start_time = Time.now
         logger.debug("STARTING")
 
-        self.tests.each do |test|
-          begin
-            result = test.run
-            raise result unless test.success?
-            if test.retried
-              result.backtrace.each{ |l| logger.info("#{test.name}: #{l}") }
-              logger.warn("#{test.name}: PASSED")
-            else
-              result.backtrace.each{ |l| logger.debug("#{test.name}: #{l}") }
-              logger.debug("#{test.name}: PASSED")
-            end
-          rescue SystemExit => err
-            #
-            # Log the backtrace if we've failed.
-            #
-            err.backtrace.each{ |l| logger.info("#{test.name}: #{l}") }
-
-            #
-            # If we get a temporary failure, retry!
-            #
-            if ( SystemExit::EX_TEMPFAIL == err.to_i and not test.retried )
-              logger.warn("#{test.name}: RETRYING (following #{err.to_s})")
-              retry
-            end
+        queue = Queue.new
+        self.tests.each{|test| queue << test}
 
-            # 
-            # Otherwise do nothing.
-            #
-            logger.warn("#{test.name}: FAILED: #{err.to_s}")
-          rescue RuntimeError => err
-            error err.to_s
+        n_workers = [[@concurrency.to_i, 1].max, queue.length].min
+
+        state_db.batch do
+          workers = (0...n_workers).collect do
+            Thread.new do
+              loop do
+                test = begin
+                  queue.pop(true)
+                rescue ThreadError
+                  break
+                end
+
+                run_test(test)
+              end
+            end
           end
 
+          workers.each{|w| w.join}
+
+          @finish_time = Time.now
+          state_db.record_run(duration, tests.length, successful_tests.length, @start_time)
         end
 
-        logger.info("RESULT: #{successful_tests.length}/#{tests.length} passed.")
-        @finish_time = Time.now
+        logger.info("RESULT: #{successful_tests.length}/#{tests.length} passed in #{"%.1f" % duration}s.")
 
         nil
       end
 
+      #
+      # Returns how long the last run took in seconds, or nil if it hasn't
+      # finished.
+      #
+      def duration
+        return nil if @start_time.nil? or @finish_time.nil?
+        @finish_time - @start_time
+      end
+
       def failed_tests
         tests - successful_tests
       end
@@ -133,6 +151,46 @@ module Symbiosis
         @state_db.clean(n_days)
       end
 
+      private
+
+      #
+      # Runs a test, retrying once if it fails temporarily, and logs the
+      # result.
+      #
+      def run_test(test)
+        begin
+          result = test.run(@timeout)
+          raise result unless test.success?
+          if test.retried
+            result.backtrace.each{ |l| logger.info("#{test.name}: #{l}") }
+            logger.warn("#{test.name}: PASSED")
+          else
+            result.backtrace.each{ |l| logger.debug("#{test.name}: #{l}") }
+            logger.debug("#{test.name}: PASSED")
+          end
+        rescue SystemExit => err
+          #
+          # Log the backtrace if we've failed.
+          #
+          err.backtrace.each{ |l| logger.info("#{test.name}: #{l}") }
+
+          #
+          # If we get a temporary failure, retry!
+          #
+          if ( SystemExit::EX_TEMPFAIL == err.to_i and not test.retried )
+            logger.warn("#{test.name}: RETRYING (following #{err.to_s})")
+            retry
+          end
+
+          # 
+          # Otherwise do nothing.
+          #
+          logger.warn("#{test.name}: FAILED: #{err.to_s}")
+        rescue RuntimeError => err
+          logger.error("#{test.name}: #{err.to_s}")
+        end
+      end
+
     end
 
   end
@@ -1,5 +1,6 @@
 require 'sqlite3'
 require 'systemexit'
+require 'thread'
 
 module Symbiosis
   module Monitor
@@ -15,6 +16,9 @@ module Symbiosis
         @dbh = SQLite3::Database.new(fn)
 
         @tbl_name = "states"
+        @runs_tbl_name = "runs"
+        @lock  = Mutex.new
+        @batch = nil
         create_table 
         @dbh.results_as_hash = true
         @dbh.type_translation = true
@@ -35,6 +39,33 @@ module Symbiosis
         @dbh.execute(sql)
         sql = "CREATE INDEX IF NOT EXISTS test_timestamp ON #{@tbl_name} (test, timestamp)" 
         @dbh.execute(sql)
+        sql = "CREATE TABLE IF NOT EXISTS #{@runs_tbl_name}
+              (
+                timestamp  INTEGER NOT NULL,
+                duration   REAL NOT NULL,
+                tests      INTEGER NOT NULL,
+                passed     INTEGER NOT NULL
+              )"
+        @dbh.execute(sql)
+      end
+
+      #
+      # Saves up everything recorded during the block, which may be from
+      # several threads, and writes it all at the end in one transaction.
+      #
+      def batch
+        @lock.synchronize do
+          raise ArgumentError, "Already batching" unless @batch.nil?
+          @batch = []
+        end
+
+        begin
+          yield
+        ensure
+          pending = nil
+          @lock.synchronize { pending, @batch = @batch, nil }
+          @dbh.transaction { pending.each{|w| w.call} } unless pending.empty?
+        end
       end
 
       def insert(test, exitstatus, output, timestamp)
@@ -53,18 +84,39 @@ module Symbiosis
       end
 
       def record(test, exitstatus, output, timestamp = Time.now)
-        #
-        # Insert or update based on the exit status of the last result.
-        #
-        last = last_result_for(test)
-
-        if last.nil? or last['exitstatus'].to_i != exitstatus
-          insert(test, exitstatus, output, timestamp.to_i)
-        else
-          update(test, exitstatus, output, timestamp.to_i, last['timestamp'].to_i)
+        write do
+          #
+          # Insert or update based on the exit status of the last result.
+          #
+          last = last_result_for(test)
+
+          if last.nil? or last['exitstatus'].to_i != exitstatus
+            insert(test, exitstatus, output, timestamp.to_i)
+          else
+            update(test, exitstatus, output, timestamp.to_i, last['timestamp'].to_i)
+          end
+        end
+      end
+
+      #
+      # Records how long a run of all the tests took, and how many passed.
+      #
+      def record_run(duration, tests, passed, timestamp = Time.now)
+        write do
+          @dbh.execute("INSERT INTO #{@runs_tbl_name}
+            VALUES (?, ?, ?, ?)",
+            timestamp.to_i, duration.to_f, tests, passed
+          )
         end
       end
 
+      #
+      # Returns the last n runs, most recent first.
+      #
+      def last_runs(n = 10)
+        @dbh.execute("SELECT * FROM #{@runs_tbl_name} ORDER BY timestamp DESC LIMIT 0,?", n)
+      end
+
       def all_results_for(test)
         @dbh.execute("SELECT * FROM #{@tbl_name} WHERE test = ?", test)
       end
@@ -95,6 +147,23 @@ module Symbiosis
       def clean(n_days = 30, now = Time.now)
         from = (now.to_i - n_days*24*3600)
         @dbh.execute("DELETE FROM #{@tbl_name} WHERE timestamp < ? ", from)
+        @dbh.execute("DELETE FROM #{@runs_tbl_name} WHERE timestamp < ? ", from)
+      end
+
+      private
+
+      #
+      # Does a write now, or saves it until the end of the batch.
+      #
+      def write(&block)
+        @lock.synchronize do
+          unless @batch.nil?
+            @batch << block
+            return nil
+          end
+        end
+
+        block.call
       end
 
     end
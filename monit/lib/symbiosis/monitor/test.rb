@@ -53,7 +53,13 @@ module Symbiosis
         end
       end
 
-      def run
+      #
+      # Runs the test script, and records the result.  If timeout is given,
+      # the script, and anything it has started, is killed if it is still
+      # running after that many seconds, and the test is treated as a
+      # temporary failure, so it is retried in the same way.
+      #
+      def run(timeout = nil)
         if @retried.nil?
           @retried = false
         else
@@ -64,11 +70,38 @@ module Symbiosis
 
         @output = []
         pid = nil
-        IO.popen(@script +" 2>&1") do |pipe|
+        timed_out = false
+        buffer = ""
+
+        #
+        # The script is put in its own process group so it can be killed
+        # along with its children.
+        #
+        IO.popen([@script, :err => [:child, :out], :pgroup => true]) do |pipe|
           pid = pipe.pid
-          @output << pipe.gets.to_s.chomp while !pipe.eof?
+          deadline = (timeout.nil? ? nil : @timestamp + timeout)
+
+          loop do
+            left = (deadline.nil? ? nil : deadline - Time.now)
+
+            if left and left <= 0
+              timed_out = true
+              kill(pid, pipe, buffer)
+              break
+            end
+
+            next if IO.select([pipe], nil, nil, left).nil?
+
+            begin
+              buffer << pipe.readpartial(4096)
+            rescue EOFError
+              break
+            end
+          end
         end
 
+        @output = buffer.split("\n")
+
         #
         # Sanity checks...
         #
@@ -76,7 +109,13 @@ module Symbiosis
         raise RuntimeError, "Somehow the command #{@script} didn't execute." unless status.is_a?(::Process::Status)
         raise RuntimeError, "Process IDs didn't match when checking #{@script}." if pid != status.pid
 
-        @exitstatus = SystemExit.new(status.exitstatus)
+        if timed_out
+          @output << "Timed out after #{timeout}s"
+          @exitstatus = SystemExit.new(SystemExit::EX_TEMPFAIL)
+        else
+          @exitstatus = SystemExit.new(status.exitstatus.to_i)
+        end
+
         @exitstatus.set_backtrace @output
 
         #
@@ -96,6 +135,35 @@ module Symbiosis
         @retried
       end
 
+      private
+
+      #
+      # Kills a process group, giving it a couple of seconds to exit after
+      # SIGTERM before sending SIGKILL.  Any more output is added to buffer.
+      #
+      def kill(pid, pipe, buffer)
+        %w(TERM KILL).each do |sig|
+          begin
+            Process.kill(sig, -pid)
+          rescue Errno::ESRCH
+            return
+          end
+
+          deadline = Time.now + 2
+
+          loop do
+            left = deadline - Time.now
+            break if left <= 0 or IO.select([pipe], nil, nil, left).nil?
+
+            begin
+              buffer << pipe.readpartial(4096)
+            rescue EOFError
+              return
+            end
+          end
+        end
+      end
+
     end
 
   end
@@ -5,6 +5,7 @@ require 'symbiosis/monitor/runner'
 require 'log4r'
 require 'log4r/outputter/syslogoutputter'
 require 'time'
+require 'tmpdir'
 
 class TestRunner < Test::Unit::TestCase
 
@@ -150,5 +151,58 @@ class TestRunner < Test::Unit::TestCase
 
   end
 
-end
+  #
+  # Makes a directory of tests that sleep, so we can see if they run at the
+  # same time, and are timed out.
+  #
+  def make_sleepy_tests(n, secs)
+    dir = Dir.mktmpdir("monit.d")
+
+    n.times do |i|
+      fn = File.join(dir, "sleepy-#{i}")
+      File.open(fn, "w") { |fh| fh.puts "#!/bin/sh\necho sleeping\nsleep #{secs}\necho woken" }
+      File.chmod(0755, fn)
+    end
+
+    dir
+  end
+
+  def test_concurrency
+    dir = make_sleepy_tests(4, 1)
+    runner = Symbiosis::Monitor::Runner.new(dir, @statedb_fn, @template_d)
+    runner.concurrency = 4
+
+    assert_nothing_raised{ runner.go }
+    assert_equal(4, runner.successful_tests.length)
+    assert(runner.duration < 3, "Tests didn't run concurrently (took #{runner.duration}s)")
+
+    runs = runner.state_db.last_runs
+    assert_equal(1, runs.length)
+    assert_equal(4, runs.first['tests'])
+    assert_equal(4, runs.first['passed'])
+  ensure
+    FileUtils.rm_rf(dir) if dir
+  end
 
+  def test_timeout
+    dir = make_sleepy_tests(1, 30)
+    runner = Symbiosis::Monitor::Runner.new(dir, @statedb_fn, @template_d)
+    runner.timeout = 1
+
+    assert_nothing_raised{ runner.go }
+    assert(runner.duration < 10, "Test wasn't killed when it timed out (took #{runner.duration}s)")
+
+    #
+    # Timeouts are treated as temporary failures, and retried.
+    #
+    test = runner.tests.first
+    assert(!test.success?)
+    assert(test.retried?)
+    assert_equal(SystemExit::EX_TEMPFAIL, test.exitstatus.to_i)
+    assert_match(/sleeping/, test.output)
+    assert_match(/Timed out/, test.output)
+  ensure
+    FileUtils.rm_rf(dir) if dir
+  end
+
+end
@@ -187,6 +187,31 @@ class TestStateDb < Test::Unit::TestCase
 
   end
 
+  def test_batch
+    test = "test_batch"
+    at = Time.now-100
+
+    @statedb.batch do
+      @statedb.record(test, 75, "Whoops", at)
+      @statedb.record(test, 0, "OK", at+1)
+      @statedb.record_run(1.5, 1, 1, at)
+
+      #
+      # Nothing should have been written yet.
+      #
+      assert_equal([], @statedb.all_results_for(test))
+    end
+
+    results = @statedb.all_results_for(test)
+    assert_equal(2, results.length)
+    assert_equal(0, @statedb.last_result_for(test)['exitstatus'])
+
+    runs = @statedb.last_runs
+    assert_equal(1, runs.length)
+    assert_equal(1.5, runs.first['duration'])
+    assert_equal(at.to_i, runs.first['timestamp'])
+  end
+
   # TODO more tests..
 
 end